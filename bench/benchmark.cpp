@@ -0,0 +1,308 @@
+/*
+File: benchmark.cpp
+Author: Alexander Schurman, alexander.schurman@gmail.com
+
+Measures the throughput of each variant of the kernels in dispatch.h, and of
+the state machine decoder in fsmDecoder.h. Run with no arguments to use
+generated text, binary and skewed corpora, or pass the files to measure.
+*/
+
+#include "../codebook.h"
+#include "../bitPack.h"
+#include "../decoder.h"
+#include "../dispatch.h"
+#include "../fsmDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+const size_t corpusSize = 16 << 20;
+
+// English-like text: words drawn with Zipf-distributed frequencies
+vector<unsigned char> makeTextCorpus()
+{
+    static const char* words[] = {
+        "the", "of", "and", "to", "a", "in", "is", "it", "you", "that", "he",
+        "was", "for", "on", "are", "with", "as", "I", "his", "they", "be",
+        "at", "one", "have", "this", "from", "or", "had", "by", "hot", "word",
+        "but", "what", "some", "we", "can", "out", "other", "were", "all",
+        "there", "when", "up", "use", "your", "how", "said", "an", "each",
+        "she", "which", "do", "their", "time", "if", "will", "way", "about",
+        "many", "then", "them", "write", "would", "like", "so", "these",
+        "her", "long", "make", "thing", "see", "him", "two", "has", "look",
+        "more", "day", "could", "go", "come", "did", "number", "sound", "no",
+        "most", "people", "my", "over", "know", "water", "than", "call",
+        "first", "who", "may", "down", "side", "been", "now", "find"
+    };
+    const int numWords = sizeof(words) / sizeof(words[0]);
+
+    vector<double> cumulative(numWords);
+    double sum = 0;
+    for (int i = 0; i < numWords; i++)
+    {
+        sum += 1.0 / (i + 1);
+        cumulative[i] = sum;
+    }
+
+    vector<unsigned char> corpus;
+    corpus.reserve(corpusSize + 16);
+    srand(1);
+    int wordsInSentence = 0;
+    while (corpus.size() < corpusSize)
+    {
+        double r = sum * rand() / RAND_MAX;
+        int w = 0;
+        while (w < numWords - 1 && cumulative[w] < r)
+        {
+            w++;
+        }
+        corpus.insert(corpus.end(), words[w], words[w] + strlen(words[w]));
+
+        if (++wordsInSentence == 12)
+        {
+            corpus.push_back('.');
+            corpus.push_back(rand() % 4 == 0 ? '\n' : ' ');
+            wordsInSentence = 0;
+        }
+        else
+        {
+            corpus.push_back(rand() % 10 == 0 ? ',' : ' ');
+        }
+    }
+    corpus.resize(corpusSize);
+    return corpus;
+}
+
+// Binary records: an incrementing id, a small enum, a skewed count and a
+// float, like a dump of an array of structs
+vector<unsigned char> makeBinaryCorpus()
+{
+    vector<unsigned char> corpus(corpusSize);
+    srand(2);
+    for (size_t i = 0; i + 16 <= corpusSize; i += 16)
+    {
+        uint32_t id = i / 16;
+        uint32_t kind = rand() % 5;
+        uint32_t count = (rand() % 100) * (rand() % 100) / 50;
+        float value = (rand() % 10000) / 100.0f;
+        memcpy(&corpus[i], &id, 4);
+        memcpy(&corpus[i + 4], &kind, 4);
+        memcpy(&corpus[i + 8], &count, 4);
+        memcpy(&corpus[i + 12], &value, 4);
+    }
+    return corpus;
+}
+
+// Low-entropy bytes, like a sparse bitmap or a delta-coded column: each
+// value is half as likely as the one before
+vector<unsigned char> makeSkewedCorpus()
+{
+    vector<unsigned char> corpus(corpusSize);
+    srand(3);
+    for (size_t i = 0; i < corpusSize; i++)
+    {
+        unsigned char value = 0;
+        while (value < 40 && rand() % 2 == 0)
+        {
+            value++;
+        }
+        corpus[i] = value;
+    }
+    return corpus;
+}
+
+bool readCorpus(const string& path, vector<unsigned char>& corpus)
+{
+    std::ifstream f(path, std::ifstream::in | std::ifstream::binary);
+    if (!f.good())
+    {
+        return false;
+    }
+    corpus.assign(std::istreambuf_iterator<char>(f),
+                  std::istreambuf_iterator<char>());
+    return true;
+}
+
+const int runs = 15;
+
+// Returns the best throughput in MB/s of input over several runs of fn
+template <typename Function>
+double timeRuns(size_t inputSize, Function fn)
+{
+    double best = 0;
+    for (int r = 0; r < runs; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double mbps = inputSize / elapsed.count() / 1e6;
+        best = mbps > best ? mbps : best;
+    }
+    return best;
+}
+
+void benchCorpus(const string& name, const vector<unsigned char>& corpus)
+{
+    uint64_t counts[huffman::numSymbols] = {0};
+    huffman::countChars(corpus.data(), corpus.size(), counts);
+    huffman::CodeTable table;
+    huffman::buildCodeTable(counts, table);
+
+    printf("%-24s %9zu bytes, longest code %2u bits\n", name.c_str(),
+           corpus.size(), table.maxBits);
+    printf("    kernels   histogram MB/s  +crc MB/s    pack MB/s          "
+           "        decode MB/s  multi MB/s  4-way MB/s\n");
+
+    unsigned char lengths[huffman::numSymbols];
+    for (unsigned int c = 0; c < huffman::numSymbols; c++)
+    {
+        lengths[c] = table.lens[c];
+    }
+    huffman::CanonicalCode code;
+    huffman::buildCanonicalCode(lengths, huffman::numSymbols, code);
+    huffman::DecodeTable* decodeTable = new huffman::DecodeTable();
+    huffman::buildDecodeTable(code, *decodeTable);
+    huffman::MultiDecodeTable* multiTable = new huffman::MultiDecodeTable();
+    huffman::buildMultiDecodeTable(code, *multiTable);
+
+    // the symbols dealt round-robin into interleaved streams
+    vector<unsigned char> streams[huffman::numStreams];
+    const unsigned char* streamData[huffman::numStreams];
+    size_t streamSizes[huffman::numStreams];
+    for (unsigned int s = 0; s < huffman::numStreams; s++)
+    {
+        vector<unsigned char> dealt;
+        for (size_t i = s; i < corpus.size(); i += huffman::numStreams)
+        {
+            dealt.push_back(corpus[i]);
+        }
+        streams[s].resize(huffman::packBound(table, dealt.size()));
+        huffman::PackState state = {0, 0};
+        size_t n = huffman::packCodes(table, dealt.data(), dealt.size(),
+                                      state, streams[s].data());
+        n += huffman::flushBits(state, streams[s].data() + n);
+        streams[s].resize(n);
+        streamData[s] = streams[s].data();
+        streamSizes[s] = n;
+    }
+
+    vector<unsigned char> scalarOut;
+    double scalarPack = 0;
+    for (int l = 0; l < huffman::numKernelLevels; l++)
+    {
+        const huffman::Kernels* k =
+            huffman::kernelsFor((huffman::KernelLevel)l);
+        if (!k)
+        {
+            printf("    level %d   not supported by this CPU\n", l);
+            continue;
+        }
+
+        double count = timeRuns(corpus.size(), [&]() {
+            uint64_t c[huffman::numSymbols] = {0};
+            k->countChars(corpus.data(), corpus.size(), c);
+        });
+        double countCrc = timeRuns(corpus.size(), [&]() {
+            uint64_t c[huffman::numSymbols] = {0};
+            uint32_t crc = 0;
+            k->countCharsCrc(corpus.data(), corpus.size(), c, crc);
+        });
+
+        vector<unsigned char> out(huffman::packBound(table, corpus.size()));
+        size_t n = 0;
+        double pack = timeRuns(corpus.size(), [&]() {
+            huffman::PackState state = {0, 0};
+            n = k->packCodes(table, corpus.data(), corpus.size(), state,
+                             out.data());
+            n += huffman::flushBits(state, out.data() + n);
+        });
+        out.resize(n);
+
+        if (l == huffman::levelScalar)
+        {
+            scalarOut = out;
+            scalarPack = pack;
+        }
+        printf("    %-8s  %14.1f %10.1f %12.1f  (%.2fx, output %s)", k->name,
+               count, countCrc, pack, pack / scalarPack,
+               out == scalarOut ? "identical" : "DIFFERS");
+
+        vector<unsigned char> decoded(corpus.size());
+        double decode = timeRuns(corpus.size(), [&]() {
+            size_t bitPos = 0;
+            k->decodeSymbols(*decodeTable, out.data(), out.size(), bitPos,
+                             out.size() * 8, decoded.data(), decoded.size());
+        });
+        printf(" %10.1f%s", decode, decoded == corpus ? "" : " WRONG");
+
+        std::fill(decoded.begin(), decoded.end(), 0);
+        double multi = timeRuns(corpus.size(), [&]() {
+            size_t bitPos = 0;
+            k->decodeMultiSymbols(*multiTable, out.data(), out.size(),
+                                  bitPos, out.size() * 8, decoded.data(),
+                                  decoded.size());
+        });
+        printf(" %11.1f%s", multi, decoded == corpus ? "" : " WRONG");
+
+        std::fill(decoded.begin(), decoded.end(), 0);
+        double interleaved = timeRuns(corpus.size(), [&]() {
+            k->decodeInterleaved(*decodeTable, streamData, streamSizes,
+                                 decoded.data(), decoded.size());
+        });
+        printf(" %11.1f%s%s\n", interleaved,
+               decoded == corpus ? "" : " WRONG",
+               huffman::preferMultiDecode(code) ? " (multi preferred)" : "");
+    }
+
+    // the state machine has one variant, fed the scalar kernels' output
+    huffman::FsmDecodeTable* fsmTable = new huffman::FsmDecodeTable();
+    if (huffman::buildFsmDecodeTable(code, *fsmTable))
+    {
+        vector<unsigned char> decoded(corpus.size());
+        double fsm = timeRuns(corpus.size(), [&]() {
+            size_t bitPos = 0;
+            huffman::decodeFsmSymbols(*fsmTable, scalarOut.data(),
+                                      scalarOut.size(), bitPos,
+                                      scalarOut.size() * 8, decoded.data(),
+                                      decoded.size());
+        });
+        printf("    state machine decode MB/s %.1f%s\n", fsm,
+               decoded == corpus ? "" : " WRONG");
+    }
+
+    delete fsmTable;
+    delete multiTable;
+    delete decodeTable;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        benchCorpus("generated text", makeTextCorpus());
+        benchCorpus("generated binary", makeBinaryCorpus());
+        benchCorpus("generated skewed", makeSkewedCorpus());
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        vector<unsigned char> corpus;
+        if (!readCorpus(argv[i], corpus))
+        {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        benchCorpus(argv[i], corpus);
+    }
+    return 0;
+}
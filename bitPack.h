@@ -0,0 +1,102 @@
+/* 
+ * File:   bitPack.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Kernels that translate symbols into codewords and pack them MSB-first into
+ * a byte buffer.
+ */
+
+#ifndef BITPACK_H
+#define	BITPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "codebook.h"
+
+namespace huffman
+{
+    /*
+    Bits that have been packed but not yet written as a whole byte. They are
+    kept left-aligned in acc, so the next bit to write is the most significant
+    bit of acc. Between calls to the packing functions, fewer than 8 bits are
+    pending.
+    */
+    struct PackState
+    {
+        uint64_t acc;
+        unsigned int bits;
+    };
+
+    // The packing functions store whole 64-bit words, so they may write up to
+    // this many bytes past the number of bytes they report having written.
+    const unsigned int packSlack = 8;
+
+    // Returns the number of bytes needed to pack size symbols with table,
+    // including packSlack.
+    inline size_t packBound(const CodeTable& table, size_t size)
+    {
+        return (size * table.maxBits + 7) / 8 + packSlack;
+    }
+
+    // Stores the pending bits of acc as a big-endian word at out and returns
+    // the number of whole bytes that were completed.
+    inline size_t storeBits(PackState& state, unsigned char* out)
+    {
+        uint64_t word = __builtin_bswap64(state.acc);
+        memcpy(out, &word, sizeof(word));
+
+        size_t bytes = state.bits >> 3;
+        state.acc <<= state.bits & ~7u;
+        state.bits &= 7;
+        return bytes;
+    }
+
+    // Writes the low len bits of code, where 0 < len <= 56.
+    // Returns the number of bytes written to out.
+    inline size_t putBits(PackState& state, uint64_t code, unsigned int len,
+                          unsigned char* out)
+    {
+        state.acc |= code << (64 - state.bits - len);
+        state.bits += len;
+        return storeBits(state, out);
+    }
+
+    // Writes the pending bits followed by zero bits up to the next byte
+    // boundary. Returns the number of bytes written to out (0 or 1).
+    inline size_t flushBits(PackState& state, unsigned char* out)
+    {
+        size_t bytes = 0;
+        if (state.bits > 0)
+        {
+            out[0] = state.acc >> 56;
+            bytes = 1;
+        }
+        state.acc = 0;
+        state.bits = 0;
+        return bytes;
+    }
+
+    // Encodes size symbols from in using table and packs the codewords into
+    // out. Every symbol of in must be present in table. Whole bytes are
+    // written to out and the leftover bits are kept in state.
+    // out needs room for packBound(table, size) bytes.
+    // Returns the number of bytes written to out.
+    size_t packCodes(const CodeTable& table, const unsigned char* in,
+                     size_t size, PackState& state, unsigned char* out);
+
+    // The variants behind packCodes, one per KernelLevel (dispatch.h).
+    // They produce bit-identical output.
+    size_t packCodesScalar(const CodeTable& table, const unsigned char* in,
+                           size_t size, PackState& state, unsigned char* out);
+    size_t packCodesSse42(const CodeTable& table, const unsigned char* in,
+                          size_t size, PackState& state, unsigned char* out);
+    size_t packCodesAvx2(const CodeTable& table, const unsigned char* in,
+                         size_t size, PackState& state, unsigned char* out);
+    size_t packCodesAvx512(const CodeTable& table, const unsigned char* in,
+                           size_t size, PackState& state, unsigned char* out);
+}
+
+#endif	/* BITPACK_H */
+
@@ -0,0 +1,86 @@
+/* 
+ * File:   bitReader.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Reads bits MSB-first from a buffer in memory.
+ */
+
+#ifndef BITREADER_H
+#define	BITREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace huffman
+{
+    /*
+    A cursor over the bits of a byte buffer, most significant bit of each
+    byte first. Bits can be peeked at before deciding how many to consume.
+    Bits past the end of the buffer read as 0; overrun() tells whether any of
+    them have been consumed.
+    */
+    class BitReader {
+    public:
+        // Reads size bytes from data, starting bitOffset bits in
+        BitReader(const unsigned char* data, size_t size, size_t bitOffset = 0)
+            : data(data), size(size), pos(bitOffset)
+        {
+        }
+
+        // Returns the next n bits (1 <= n <= 57) without consuming them, in
+        // the low bits of the result
+        uint64_t peek(unsigned int n) const
+        {
+            return loadWord() << (pos & 7) >> (64 - n);
+        }
+
+        void consume(unsigned int n) { pos += n; }
+
+        // Returns the next n bits (1 <= n <= 57) and consumes them
+        uint64_t read(unsigned int n)
+        {
+            uint64_t bits = peek(n);
+            consume(n);
+            return bits;
+        }
+
+        // the number of bits consumed since the start of the buffer
+        size_t bitPos() const { return pos; }
+
+        size_t bitSize() const { return size * 8; }
+
+        bool overrun() const { return pos > size * 8; }
+
+    private:
+        // Returns the 8 bytes starting at the byte holding the next bit
+        uint64_t loadWord() const
+        {
+            size_t byte = pos >> 3;
+            uint64_t word = 0;
+            if (byte + 8 <= size)
+            {
+                memcpy(&word, data + byte, sizeof(word));
+                return __builtin_bswap64(word);
+            }
+
+            // Near the end, assemble the word a byte at a time
+            for (int i = 0; i < 8; i++)
+            {
+                word <<= 8;
+                if (byte + i < size)
+                {
+                    word |= data[byte + i];
+                }
+            }
+            return word;
+        }
+
+        const unsigned char* data;
+        size_t size;
+        size_t pos;
+    };
+}
+
+#endif	/* BITREADER_H */
+
@@ -0,0 +1,886 @@
+/* 
+ * File:   block.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "block.h"
+#include "bitPack.h"
+#include "bitReader.h"
+#include "checksum.h"
+#include "codebook.h"
+#include "decoder.h"
+#include "fsmDecoder.h"
+#include "staticBooks.h"
+
+#include <cstring>
+
+namespace huffman
+{
+    namespace
+    {
+        // the number of symbols packed at a time when the output is nearly
+        // full and has to go through a scratch buffer
+        const size_t tailChunk = 512;
+
+        // the smallest block worth splitting into interleaved streams
+        const size_t interleaveThreshold = 1 << 14;
+
+        // Packs size symbols of in, stride bytes apart, into out, which has
+        // room for capacity bytes, without ever writing past it. Returns the
+        // number of bytes written or 0 if they don't fit.
+        size_t packBounded(const CodeTable& table, const unsigned char* in,
+                           size_t size, size_t stride, unsigned char* out,
+                           size_t capacity)
+        {
+            PackState state = {0, 0};
+            size_t written = 0;
+            size_t i = 0;
+
+            // Pack contiguous symbols straight into out while the worst case
+            // of the rest fits
+            if (stride == 1)
+            {
+                size_t direct = size;
+                if (packBound(table, size) > capacity)
+                {
+                    size_t room = capacity > packSlack ? capacity - packSlack
+                                                       : 0;
+                    direct = room * 8 / table.maxBits;
+                }
+                written += packCodes(table, in, direct, state, out);
+                i = direct;
+            }
+
+            // then gather and pack the remainder through scratch buffers
+            unsigned char gathered[tailChunk];
+            unsigned char scratch[tailChunk * maxCodeBits / 8 + packSlack];
+            while (i < size)
+            {
+                size_t n = size - i < tailChunk ? size - i : tailChunk;
+                const unsigned char* chunk = in + i;
+                if (stride != 1)
+                {
+                    for (size_t j = 0; j < n; j++)
+                    {
+                        gathered[j] = in[(i + j) * stride];
+                    }
+                    chunk = gathered;
+                }
+
+                size_t packed = packCodes(table, chunk, n, state, scratch);
+                if (written + packed > capacity)
+                {
+                    return 0;
+                }
+                memcpy(out + written, scratch, packed);
+                written += packed;
+                i += n;
+            }
+
+            if (state.bits > 0)
+            {
+                if (written + 1 > capacity)
+                {
+                    return 0;
+                }
+                written += flushBits(state, out + written);
+            }
+            return written;
+        }
+
+        // Packs the size symbols of in into numStreams streams, dealt
+        // round-robin, after a table of the first numStreams - 1 streams'
+        // sizes. Returns the number of bytes written to out, which has room
+        // for capacity bytes, or 0 if they don't fit.
+        size_t packInterleaved(const CodeTable& table, const unsigned char* in,
+                               size_t size, unsigned char* out,
+                               size_t capacity)
+        {
+            const size_t sizesSize = 4 * (numStreams - 1);
+            if (capacity < sizesSize)
+            {
+                return 0;
+            }
+
+            size_t written = sizesSize;
+            for (unsigned int s = 0; s < numStreams; s++)
+            {
+                size_t count = size > s ? (size - s - 1) / numStreams + 1 : 0;
+                size_t packed = 0;
+                if (count > 0)
+                {
+                    packed = packBounded(table, in + s, count, numStreams,
+                                         out + written, capacity - written);
+                    if (packed == 0)
+                    {
+                        return 0;
+                    }
+                }
+                if (s + 1 < numStreams)
+                {
+                    putLE32(out + 4 * s, packed);
+                }
+                written += packed;
+            }
+            return written;
+        }
+
+        // Decodes size symbols from the payload of length payloadSize at
+        // data into out, by calling decode with table. Returns false if the
+        // payload doesn't hold exactly that many symbols' codewords (give or
+        // take the zero padding).
+        template <typename Table>
+        bool decodePayload(size_t (*decode)(const Table&, const unsigned char*,
+                                            size_t, size_t&, size_t,
+                                            unsigned char*, size_t),
+                           const Table& table, const unsigned char* data,
+                           size_t payloadSize, unsigned char* out, size_t size)
+        {
+            size_t bitPos = 0;
+            size_t endBit = payloadSize * 8;
+            size_t n = decode(table, data, payloadSize, bitPos, endBit, out,
+                              size);
+            return n == size && bitPos <= endBit;
+        }
+
+        // Decodes size symbols with table from the interleaved streams in
+        // the payload of length payloadSize at data into out. Returns false
+        // if the payload is corrupt.
+        bool decodeStreams(const DecodeTable& table,
+                           const unsigned char* data, size_t payloadSize,
+                           unsigned char* out, size_t size)
+        {
+            const size_t sizesSize = 4 * (numStreams - 1);
+            if (payloadSize < sizesSize)
+            {
+                return false;
+            }
+
+            const unsigned char* streams[numStreams];
+            size_t sizes[numStreams];
+            size_t offset = sizesSize;
+            for (unsigned int s = 0; s + 1 < numStreams; s++)
+            {
+                sizes[s] = getLE32(data + 4 * s);
+                if (sizes[s] > payloadSize - offset)
+                {
+                    return false;
+                }
+                streams[s] = data + offset;
+                offset += sizes[s];
+            }
+            streams[numStreams - 1] = data + offset;
+            sizes[numStreams - 1] = payloadSize - offset;
+            return decodeInterleaved(table, streams, sizes, out, size);
+        }
+
+        // Returns true if size symbols with the given counts, packed with
+        // table into numStreams streams, fit within blockBound
+        bool interleavedFits(const CodeTable& table, const uint64_t* counts,
+                             size_t size)
+        {
+            uint64_t bits = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                bits += counts[c] * table.lens[c];
+            }
+            return bits / 8 + numStreams + 4 * (numStreams - 1) <= size;
+        }
+
+        // Sets bits to the number of bits table codes the symbols counted
+        // in counts in. Returns false if it has no codeword for one of them.
+        bool codedBits(const CodeTable& table, const uint64_t* counts,
+                       uint64_t& bits)
+        {
+            bool covers = true;
+            bits = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                covers = covers && (counts[c] == 0 || table.lens[c] > 0);
+                bits += counts[c] * table.lens[c];
+            }
+            return covers;
+        }
+
+        // Returns true if blocks of type give a codebook of their own
+        inline bool hasCodebook(BlockType type)
+        {
+            return type == blockHuffman || type == blockInterleaved;
+        }
+
+        // the bytes of a compact codebook's bitmap of present symbols
+        const size_t bitmapSize = numSymbols / 8;
+
+        // the bits a compact codebook gives each length in
+        const unsigned int compactLengthBits = 5;
+
+        // Writes table's lengths to out as a compact codebook. Returns the
+        // number of bytes written, codebookSize(table).
+        size_t putCodebook(const CodeTable& table, unsigned char* out)
+        {
+            unsigned char codebook[maxCodebookSize + packSlack] = {0};
+            codebook[0] = codebookLengths;
+            PackState state = {0, 0};
+            size_t written = 1 + bitmapSize;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                if (table.lens[c] > 0)
+                {
+                    codebook[1 + c / 8] |= 0x80 >> (c % 8);
+                    written += putBits(state, table.lens[c] - 1,
+                                       compactLengthBits, codebook + written);
+                }
+            }
+            written += flushBits(state, codebook + written);
+            memcpy(out, codebook, written);
+            return written;
+        }
+
+        // Parses the compact codebook of kind codebookLengths at the start
+        // of the size bytes at body into lengths, and sets used to the
+        // number of bytes it takes. Returns false if it's cut off.
+        bool parseLengths(const unsigned char* body, size_t size,
+                          unsigned char* lengths, size_t& used)
+        {
+            if (size < 1 + bitmapSize || body[0] != codebookLengths)
+            {
+                return false;
+            }
+
+            BitReader in(body, size, (1 + bitmapSize) * 8);
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                lengths[c] = 0;
+                if (body[1 + c / 8] & 0x80 >> (c % 8))
+                {
+                    lengths[c] = in.read(compactLengthBits) + 1;
+                }
+            }
+            used = (in.bitPos() + 7) / 8;
+            return !in.overrun();
+        }
+
+        // Parses the codebook at the start of the size bytes at body of a
+        // Huffman or interleaved block described by header, setting kind to
+        // its kind and used to the number of bytes it takes. Its lengths go
+        // to lengths if it gives them; if it selects a shared code, its
+        // index goes to index. Returns false if the codebook is cut off.
+        bool parseCodebook(const BlockHeader& header, const unsigned char* body,
+                           size_t size, unsigned char* lengths, size_t& used,
+                           CodebookKind& kind, unsigned int& index)
+        {
+            kind = codebookLengths;
+            if (!header.compact)
+            {
+                used = numSymbols;
+                if (size < used)
+                {
+                    return false;
+                }
+                memcpy(lengths, body, numSymbols);
+                return true;
+            }
+
+            if (size < 1 || body[0] > codebookShared)
+            {
+                return false;
+            }
+            kind = (CodebookKind)body[0];
+            if (kind == codebookRepeat)
+            {
+                used = 1;
+                return true;
+            }
+            if (kind == codebookShared)
+            {
+                used = 2;
+                if (size < used)
+                {
+                    return false;
+                }
+                index = body[1];
+                return true;
+            }
+            return parseLengths(body, size, lengths, used);
+        }
+
+        // Decodes the shared codes block described by header, whose
+        // payload is at body, making its codes context's shared codes if
+        // context is given. Returns false if the payload is corrupt.
+        bool decodeSharedCodes(const BlockHeader& header,
+                               const unsigned char* body,
+                               CodeContext* context)
+        {
+            if (header.rawSize != 0 || header.payloadSize < 1
+                || body[0] > maxSharedCodes)
+            {
+                return false;
+            }
+            unsigned int count = body[0];
+            unsigned char lengths[maxSharedCodes][numSymbols];
+            size_t offset = 1;
+            for (unsigned int g = 0; g < count; g++)
+            {
+                size_t used;
+                if (!parseLengths(body + offset, header.payloadSize - offset,
+                                  lengths[g], used))
+                {
+                    return false;
+                }
+                offset += used;
+            }
+
+            std::shared_ptr<SharedCodes> shared =
+                std::make_shared<SharedCodes>();
+            if (offset != header.payloadSize
+                || !buildSharedCodes(lengths, count, *shared))
+            {
+                return false;
+            }
+            if (context)
+            {
+                context->shared = shared;
+            }
+            return true;
+        }
+
+        // Fills in the payload size of the block of written bytes at out, and
+        // its checksum crc if checksum is true. Returns written.
+        size_t finishBlock(unsigned char* out, size_t written, bool checksum,
+                           uint32_t crc)
+        {
+            if (checksum)
+            {
+                out[0] |= checksumFlag;
+                putLE32(out + blockHeaderSize, crc);
+            }
+            putLE32(out + 5, written - blockHeaderSize);
+            return written;
+        }
+
+        // Tries to encode the size bytes of in with a static codebook.
+        // Returns the number of bytes written after the block header,
+        // or 0 if the static code would be larger than blockBound allows.
+        size_t encodeStatic(const unsigned char* in, size_t size,
+                            unsigned char* out, size_t capacity)
+        {
+            unsigned int id = chooseStaticBook(in, size);
+            const CodeTable& table = staticCodeTable(id);
+
+            // Short inputs can't outgrow the bound, but for longer ones the
+            // sample might have been misleading.
+            if (1 + (size * table.maxBits + 7) / 8 > numSymbols + size)
+            {
+                size_t bits = 0;
+                for (size_t i = 0; i < size; i++)
+                {
+                    bits += table.lens[in[i]];
+                }
+                if (1 + (bits + 7) / 8 > numSymbols + size)
+                {
+                    return 0;
+                }
+            }
+
+            if (capacity < 1)
+            {
+                return 0;
+            }
+            out[0] = id;
+            size_t packed = packBounded(table, in, size, 1, out + 1,
+                                        capacity - 1);
+            return packed == 0 ? 0 : 1 + packed;
+        }
+    }
+
+    size_t codebookSize(const CodeTable& table)
+    {
+        size_t present = 0;
+        for (unsigned int c = 0; c < numSymbols; c++)
+        {
+            present += table.lens[c] > 0;
+        }
+        return 1 + bitmapSize + (present * compactLengthBits + 7) / 8;
+    }
+
+    bool buildSharedCodes(const unsigned char (*lengths)[numSymbols],
+                          unsigned int count, SharedCodes& shared)
+    {
+        if (count > maxSharedCodes)
+        {
+            return false;
+        }
+        shared.count = count;
+        for (unsigned int g = 0; g < count; g++)
+        {
+            CanonicalCode code;
+            if (!buildCanonicalCode(lengths[g], numSymbols, code)
+                || code.numCodes == 0)
+            {
+                return false;
+            }
+            memcpy(shared.lengths[g], lengths[g], numSymbols);
+            buildCodeTable(code, shared.tables[g]);
+            buildDecodeTable(code, shared.decodeTables[g]);
+        }
+        return true;
+    }
+
+    size_t encodeSharedCodes(std::shared_ptr<const SharedCodes> shared,
+                             unsigned char* out, size_t capacity,
+                             CodeContext& context)
+    {
+        size_t written = blockHeaderSize + 1;
+        for (unsigned int g = 0; g < shared->count; g++)
+        {
+            written += codebookSize(shared->tables[g]);
+        }
+        if (capacity < written)
+        {
+            return 0;
+        }
+
+        out[0] = blockSharedCodes;
+        putLE32(out + 1, 0);
+        putLE32(out + 5, written - blockHeaderSize);
+        written = blockHeaderSize;
+        out[written++] = shared->count;
+        for (unsigned int g = 0; g < shared->count; g++)
+        {
+            written += putCodebook(shared->tables[g], out + written);
+        }
+
+        // like any block with no code of its own, it counts towards the run
+        // since the last one
+        context.shared = shared;
+        context.sinceCode++;
+        return written;
+    }
+
+    size_t encodeBlock(const unsigned char* in, size_t size, bool last,
+                       unsigned char* out, size_t capacity,
+                       CodeContext* context, bool checksum,
+                       const uint64_t* given)
+    {
+        size_t written = blockHeaderSize + (checksum ? blockChecksumSize : 0);
+        if (capacity < written)
+        {
+            return 0;
+        }
+
+        out[0] = blockHuffman | (last ? lastBlockFlag : 0);
+        putLE32(out + 1, size);
+        uint32_t crc = 0;
+
+        // A run of one byte needs only that byte
+        if (size > 0 && memcmp(in, in + 1, size - 1) == 0)
+        {
+            if (capacity < written + 1)
+            {
+                return 0;
+            }
+            out[0] = blockRun | (last ? lastBlockFlag : 0);
+            out[written++] = in[0];
+            if (context)
+            {
+                context->sinceCode++;
+            }
+            crc = checksum ? crc32c(in, size) : 0;
+            return finishBlock(out, written, checksum, crc);
+        }
+
+        size_t staticSize = 0;
+        if (size > 0 && size < staticBookThreshold)
+        {
+            staticSize = encodeStatic(in, size, out + written,
+                                      capacity - written);
+            if (staticSize >= size)
+            {
+                staticSize = 0;
+            }
+            if (staticSize > 0)
+            {
+                out[0] = blockStatic | (last ? lastBlockFlag : 0);
+                written += staticSize;
+                crc = checksum ? crc32c(in, size) : 0;
+            }
+        }
+
+        bool ownCode = false;
+        if (size > 0 && staticSize == 0)
+        {
+            uint64_t counts[numSymbols] = {0};
+            if (given)
+            {
+                memcpy(counts, given, sizeof(counts));
+                crc = checksum ? crc32c(in, size) : 0;
+            }
+            else if (checksum)
+            {
+                countCharsCrc(in, size, counts, crc);
+            }
+            else
+            {
+                countChars(in, size, counts);
+            }
+            CodeTable own;
+            buildCodeTable(counts, own);
+            uint64_t ownBits = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                ownBits += counts[c] * own.lens[c];
+            }
+
+            // Repeat the stream's last code if it codes every symbol here
+            // in fewer bytes than our own code and its codebook take
+            const CodeTable* table = &own;
+            uint64_t bits = ownBits;
+            CodebookKind kind = codebookLengths;
+            size_t codebook = codebookSize(own);
+            CodeTable previous;
+            if (context && context->valid
+                && context->sinceCode < maxRepeatRun)
+            {
+                CanonicalCode code;
+                buildCanonicalCode(context->lengths, numSymbols, code);
+                buildCodeTable(code, previous);
+
+                uint64_t previousBits;
+                if (codedBits(previous, counts, previousBits)
+                    && 1 + (previousBits + 7) / 8
+                       <= codebook + (ownBits + 7) / 8)
+                {
+                    table = &previous;
+                    bits = previousBits;
+                    kind = codebookRepeat;
+                    codebook = 1;
+                }
+            }
+
+            // or select one of the stream's shared codes if it's smaller
+            // still
+            unsigned int sharedIndex = 0;
+            if (context && context->shared)
+            {
+                const SharedCodes& shared = *context->shared;
+                for (unsigned int g = 0; g < shared.count; g++)
+                {
+                    uint64_t sharedBits;
+                    if (codedBits(shared.tables[g], counts, sharedBits)
+                        && 2 + (sharedBits + 7) / 8
+                           < codebook + (bits + 7) / 8)
+                    {
+                        table = &shared.tables[g];
+                        bits = sharedBits;
+                        kind = codebookShared;
+                        codebook = 2;
+                        sharedIndex = g;
+                    }
+                }
+            }
+
+            // Store the input when the code would barely shrink it, before
+            // spending any time packing it
+            size_t coded = codebook + (bits + 7) / 8;
+            if (coded + size / storedMinSaving >= size)
+            {
+                if (capacity < written + size)
+                {
+                    return 0;
+                }
+                memcpy(out + written, in, size);
+                out[0] = blockStored | (last ? lastBlockFlag : 0);
+                if (context)
+                {
+                    context->sinceCode++;
+                }
+                return finishBlock(out, written + size, checksum, crc);
+            }
+
+            ownCode = kind == codebookLengths;
+            if (capacity < written + codebook)
+            {
+                return 0;
+            }
+            if (ownCode)
+            {
+                written += putCodebook(own, out + written);
+            }
+            else
+            {
+                out[written++] = kind;
+                if (kind == codebookShared)
+                {
+                    out[written++] = sharedIndex;
+                }
+            }
+
+            // Interleave large blocks whose codewords all fit a decoder's
+            // first level, as long as the stream sizes and padding still
+            // leave the block within blockBound
+            BlockType type = blockHuffman;
+            size_t packed;
+            if (size >= interleaveThreshold
+                && table->maxBits <= decodeTableBits
+                && interleavedFits(*table, counts, size))
+            {
+                type = blockInterleaved;
+                packed = packInterleaved(*table, in, size, out + written,
+                                         capacity - written);
+            }
+            else
+            {
+                packed = packBounded(*table, in, size, 1, out + written,
+                                     capacity - written);
+            }
+            if (packed == 0)
+            {
+                return 0;
+            }
+            out[0] = type | compactCodebookFlag | (last ? lastBlockFlag : 0);
+            written += packed;
+
+            if (context && ownCode)
+            {
+                for (unsigned int c = 0; c < numSymbols; c++)
+                {
+                    context->lengths[c] = own.lens[c];
+                }
+                context->valid = true;
+                context->sinceCode = 0;
+            }
+        }
+
+        // every other block counts towards the run since the last code
+        if (context && !ownCode)
+        {
+            context->sinceCode++;
+        }
+
+        return finishBlock(out, written, checksum, crc);
+    }
+
+    bool readBlockHeader(const unsigned char* in, size_t size,
+                         BlockHeader& header)
+    {
+        if (size < blockHeaderSize)
+        {
+            return false;
+        }
+
+        header.type = (BlockType)(in[0] & ~(lastBlockFlag | compactCodebookFlag
+                                            | checksumFlag));
+        header.last = (in[0] & lastBlockFlag) != 0;
+        header.compact = (in[0] & compactCodebookFlag) != 0;
+        header.checksummed = (in[0] & checksumFlag) != 0;
+        header.rawSize = getLE32(in + 1);
+        header.payloadSize = getLE32(in + 5);
+
+        // only blocks with a codebook can have a compact one
+        return header.type <= blockSharedCodes
+               && !(header.compact && !hasCodebook(header.type))
+               && header.rawSize <= maxBlockSize;
+    }
+
+    bool decodeBlock(const BlockHeader& header, const unsigned char* body,
+                     unsigned char* out, CodeContext* context)
+    {
+        // check what the rest of the block decodes to against its checksum
+        if (header.checksummed)
+        {
+            BlockHeader rest = header;
+            rest.checksummed = false;
+            rest.payloadSize -= blockChecksumSize;
+            return header.payloadSize >= blockChecksumSize
+                   && decodeBlock(rest, body + blockChecksumSize, out, context)
+                   && crc32c(out, header.rawSize) == getLE32(body);
+        }
+
+        // blocks with no code of their own count towards the run since the
+        // last one
+        if (context && (header.rawSize == 0 || !hasCodebook(header.type)))
+        {
+            context->sinceCode++;
+        }
+
+        if (header.type == blockSharedCodes)
+        {
+            return decodeSharedCodes(header, body, context);
+        }
+
+        if (header.rawSize == 0)
+        {
+            return header.payloadSize == 0;
+        }
+
+        if (header.type == blockStored)
+        {
+            if (header.payloadSize != header.rawSize)
+            {
+                return false;
+            }
+            memcpy(out, body, header.rawSize);
+            return true;
+        }
+
+        if (header.type == blockRun)
+        {
+            if (header.payloadSize != 1)
+            {
+                return false;
+            }
+            memset(out, body[0], header.rawSize);
+            return true;
+        }
+
+        if (header.type == blockDictionary)
+        {
+            return false;
+        }
+
+        if (header.type == blockStatic)
+        {
+            if (header.payloadSize < 1 || body[0] >= numStaticBooks)
+            {
+                return false;
+            }
+            return decodePayload(decodeSymbols, staticDecodeTable(body[0]),
+                                 body + 1, header.payloadSize - 1, out,
+                                 header.rawSize);
+        }
+
+        unsigned char lengths[numSymbols];
+        size_t used;
+        CodebookKind kind;
+        unsigned int index;
+        if (!parseCodebook(header, body, header.payloadSize, lengths, used,
+                           kind, index))
+        {
+            return false;
+        }
+        const unsigned char* payload = body + used;
+        size_t payloadSize = header.payloadSize - used;
+
+        // a shared code's tables are already built
+        if (kind == codebookShared)
+        {
+            if (!context || !context->shared
+                || index >= context->shared->count)
+            {
+                return false;
+            }
+            context->sinceCode++;
+            const DecodeTable& table = context->shared->decodeTables[index];
+            if (header.type == blockInterleaved)
+            {
+                return decodeStreams(table, payload, payloadSize, out,
+                                     header.rawSize);
+            }
+            return decodePayload(decodeSymbols, table, payload, payloadSize,
+                                 out, header.rawSize);
+        }
+
+        if (kind == codebookRepeat)
+        {
+            if (!context || !context->valid
+                || context->sinceCode >= maxRepeatRun)
+            {
+                return false;
+            }
+            memcpy(lengths, context->lengths, numSymbols);
+            context->sinceCode++;
+        }
+        else if (context)
+        {
+            memcpy(context->lengths, lengths, numSymbols);
+            context->valid = true;
+            context->sinceCode = 0;
+        }
+
+        CanonicalCode code;
+        if (!buildCanonicalCode(lengths, numSymbols, code)
+            || code.numCodes == 0)
+        {
+            return false;
+        }
+
+        if (header.type == blockInterleaved)
+        {
+            DecodeTable table;
+            buildDecodeTable(code, table);
+            return decodeStreams(table, payload, payloadSize, out,
+                                 header.rawSize);
+        }
+
+        DecodeMethod method = decodeMethod(code);
+        if (method == methodMulti)
+        {
+            MultiDecodeTable multi;
+            buildMultiDecodeTable(code, multi);
+            return decodePayload(decodeMultiSymbols, multi, payload,
+                                 payloadSize, out, header.rawSize);
+        }
+
+        // codes too sparse for the state machine fall back to a lookup
+        FsmDecodeTable fsm;
+        if (method == methodFsm && buildFsmDecodeTable(code, fsm))
+        {
+            return decodePayload(decodeFsmSymbols, fsm, payload, payloadSize,
+                                 out, header.rawSize);
+        }
+
+        DecodeTable table;
+        buildDecodeTable(code, table);
+        return decodePayload(decodeSymbols, table, payload, payloadSize, out,
+                             header.rawSize);
+    }
+
+    bool repeatsCode(const BlockHeader& header, const unsigned char* body)
+    {
+        size_t check = header.checksummed ? blockChecksumSize : 0;
+        return header.compact && hasCodebook(header.type)
+               && header.rawSize > 0 && header.payloadSize >= check + 1
+               && body[check] == codebookRepeat;
+    }
+
+    bool selectsSharedCode(const BlockHeader& header,
+                           const unsigned char* body)
+    {
+        size_t check = header.checksummed ? blockChecksumSize : 0;
+        return header.compact && hasCodebook(header.type)
+               && header.rawSize > 0 && header.payloadSize >= check + 1
+               && body[check] == codebookShared;
+    }
+
+    bool readBlockCode(const BlockHeader& header, const unsigned char* body,
+                       size_t size, CodeContext& context)
+    {
+        if (header.rawSize == 0 || !hasCodebook(header.type))
+        {
+            return false;
+        }
+
+        size = size < header.payloadSize ? size : header.payloadSize;
+        if (header.checksummed)
+        {
+            if (size < blockChecksumSize)
+            {
+                return false;
+            }
+            body += blockChecksumSize;
+            size -= blockChecksumSize;
+        }
+        size_t used;
+        CodebookKind kind;
+        unsigned int index;
+        if (!parseCodebook(header, body, size, context.lengths, used, kind,
+                           index)
+            || kind != codebookLengths)
+        {
+            return false;
+        }
+        context.valid = true;
+        context.sinceCode = 0;
+        return true;
+    }
+}
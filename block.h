@@ -0,0 +1,245 @@
+/* 
+ * File:   block.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * The block layout shared by the streaming and in-memory codecs.
+ *
+ * An encoded stream is a sequence of blocks. Each block starts with a header:
+ *     1 byte  - block type in the low 5 bits; the high bit is set on the last
+ *               block of the stream, the next one if the block's codebook
+ *               is compact, and the one after if it has a checksum
+ *     4 bytes - number of bytes the block decodes to (little-endian)
+ *     4 bytes - number of bytes in the rest of the block (little-endian)
+ * and, if it has a checksum,
+ *     4 bytes - the CRC-32C of the bytes the block decodes to (little-endian)
+ * A Huffman block (blockHuffman) then has the codeword length of every
+ * symbol, one byte each in symbol order, followed by the codewords packed
+ * MSB-first and zero-padded to a whole byte. A static block (blockStatic)
+ * has the one-byte id of a static codebook (staticBooks.h) in place of the
+ * lengths. An interleaved block (blockInterleaved) has the lengths, then
+ * deals its symbols round-robin into 4 streams, each packed like a Huffman
+ * block's codewords, which can be decoded in lockstep. The streams follow
+ * the sizes of the first 3 in bytes (4 bytes each, little-endian); the last
+ * one takes the rest of the block. A stored block (blockStored) has the
+ * input bytes as they are, for data a code would barely shrink. A run
+ * block (blockRun) has the one byte every byte it decodes to is. A
+ * dictionary block (blockDictionary) is coded with a pretrained codebook,
+ * and is only decoded with it (see dictionary.h). A shared codes block
+ * (blockSharedCodes) decodes to 0 bytes, and gives codes the blocks after
+ * it in the stream can select: the number of codes (1 byte, at most
+ * maxSharedCodes), then each one as a compact codebook. Any other block
+ * that decodes to 0 bytes has nothing else after its header.
+ *
+ * A compact codebook, which takes the place of the 256 lengths, is
+ *     1 byte   - codebookLengths, codebookRepeat to reuse the code of the
+ *                last block before it that had one, or codebookShared to
+ *                use one of the stream's shared codes
+ * and for codebookShared
+ *     1 byte   - the index of the shared code
+ * or for codebookLengths
+ *     32 bytes - a bitmap of the symbols present, symbol s being the bit
+ *                0x80 >> (s % 8) of byte s / 8
+ *     each present symbol's length minus 1, in 5 bits, packed MSB-first in
+ *     symbol order and zero-padded to a whole byte
+ * A block can only repeat the code of one of the maxRepeatRun blocks before
+ * it, so a reader that starts mid-stream never has to look far for it. The
+ * shared codes a block selects are those of the last shared codes block
+ * before it, which the encoders only write as the first block of a stream.
+ */
+
+#ifndef BLOCK_H
+#define	BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "codebook.h"
+#include "decoder.h"
+
+namespace huffman
+{
+    enum BlockType
+    {
+        blockHuffman = 0,
+        blockStatic = 1,
+        blockInterleaved = 2,
+        blockStored = 3,
+        blockRun = 4,
+        blockDictionary = 5,
+        blockSharedCodes = 6
+    };
+
+    // set in the type byte of the last block of a stream
+    const unsigned char lastBlockFlag = 0x80;
+
+    // set in the type byte of a block whose codebook is compact
+    const unsigned char compactCodebookFlag = 0x40;
+
+    // set in the type byte of a block with a checksum
+    const unsigned char checksumFlag = 0x20;
+
+    // the bytes of a block's checksum, if it has one
+    const size_t blockChecksumSize = 4;
+
+    enum CodebookKind
+    {
+        codebookLengths = 0,
+        codebookRepeat = 1,
+        codebookShared = 2
+    };
+
+    // the most bytes a block's codebook takes, compact or not
+    const size_t maxCodebookSize = 256;
+
+    // the furthest back the block whose code a block repeats can be
+    const unsigned int maxRepeatRun = 16;
+
+    // the most codes a shared codes block gives
+    const unsigned int maxSharedCodes = 8;
+
+    const size_t blockHeaderSize = 9;
+
+    // the number of input bytes per block unless the caller picks another
+    const size_t defaultBlockSize = 1 << 17;
+
+    // A codeword can only be d bits long if the input has at least F(d+2)
+    // symbols, F being the Fibonacci numbers, so blocks of up to 4 MiB keep
+    // every codeword within 31 bits.
+    const size_t maxBlockSize = 1 << 22;
+
+    inline void putLE32(unsigned char* out, uint32_t value)
+    {
+        out[0] = value;
+        out[1] = value >> 8;
+        out[2] = value >> 16;
+        out[3] = value >> 24;
+    }
+
+    inline uint32_t getLE32(const unsigned char* in)
+    {
+        return (uint32_t)in[0] | (uint32_t)in[1] << 8
+               | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+    }
+
+    inline void putLE64(unsigned char* out, uint64_t value)
+    {
+        putLE32(out, value);
+        putLE32(out + 4, value >> 32);
+    }
+
+    inline uint64_t getLE64(const unsigned char* in)
+    {
+        return (uint64_t)getLE32(in) | (uint64_t)getLE32(in + 4) << 32;
+    }
+
+    struct BlockHeader
+    {
+        BlockType type;
+        bool last;
+        bool compact;         // the codebook is compact
+        bool checksummed;     // the payload starts with a checksum
+        uint32_t rawSize;     // the number of bytes the block decodes to
+        uint32_t payloadSize; // the number of bytes after the header
+    };
+
+    // a block is stored unless its code saves at least 1 / storedMinSaving
+    // of its size, as decoding a stored block is only a copy
+    const size_t storedMinSaving = 32;
+
+    // Returns the most bytes an encoded block of size input bytes takes.
+    // A Huffman code never spends more bits than a fixed 8-bit code would,
+    // so the codewords take at most size bytes.
+    inline size_t blockBound(size_t size)
+    {
+        return blockHeaderSize + blockChecksumSize + 256 + size;
+    }
+
+    // Codes the blocks of a stream share, with the tables to encode and
+    // decode with them, built once
+    struct SharedCodes
+    {
+        unsigned int count;
+        unsigned char lengths[maxSharedCodes][numSymbols];
+        CodeTable tables[maxSharedCodes];
+        DecodeTable decodeTables[maxSharedCodes];
+    };
+
+    // Builds shared from count (at most maxSharedCodes) codes' lengths.
+    // Returns false if one of them isn't a prefix code with a codeword.
+    bool buildSharedCodes(const unsigned char (*lengths)[numSymbols],
+                          unsigned int count, SharedCodes& shared);
+
+    // The codes the blocks of a stream can reuse: the lengths of the last
+    // block that gave them, the number of blocks since, and the codes of
+    // the last shared codes block, if any
+    struct CodeContext
+    {
+        bool valid = false;
+        unsigned char lengths[256];
+        unsigned int sinceCode = 0;
+        std::shared_ptr<const SharedCodes> shared;
+    };
+
+    // Returns the number of bytes a compact codebook of table's lengths
+    // takes
+    size_t codebookSize(const CodeTable& table);
+
+    // Encodes a shared codes block giving shared into out, which has room
+    // for capacity bytes, and makes it the shared codes of context. Blocks
+    // encoded with context after it can then select one of them, when
+    // that's smaller than giving their own.
+    // Returns the number of bytes written to out, or 0 if out is too small.
+    size_t encodeSharedCodes(std::shared_ptr<const SharedCodes> shared,
+                             unsigned char* out, size_t capacity,
+                             CodeContext& context);
+
+    // Encodes size (at most maxBlockSize) bytes of in as one block, marked
+    // as the last block of its stream if last is true, into out, which has
+    // room for capacity bytes. Never writes past out + capacity. If context
+    // is given, it follows the blocks of the stream, and the block repeats
+    // its code when that's smaller than giving its own. Input the code
+    // wouldn't shrink enough is stored instead. If checksum is true, the
+    // block has a checksum, computed as the input is histogrammed. If
+    // counts is given, it holds the byte counts of in (as chooseBlockEnd
+    // gives them), and the input isn't counted again.
+    // Returns the number of bytes written to out, or 0 if out is too small.
+    size_t encodeBlock(const unsigned char* in, size_t size, bool last,
+                       unsigned char* out, size_t capacity,
+                       CodeContext* context = NULL, bool checksum = false,
+                       const uint64_t* counts = NULL);
+
+    // Parses the block header at the start of the size bytes at in.
+    // Returns false if there are too few bytes or the header is invalid.
+    bool readBlockHeader(const unsigned char* in, size_t size,
+                         BlockHeader& header);
+
+    // Decodes the block described by header, whose payload is at body,
+    // into out, which has room for header.rawSize bytes. context, if given,
+    // follows the blocks of the stream; a block that repeats a code needs it.
+    // Returns false if the payload is corrupt, or what it decodes to doesn't
+    // match its checksum, or it's a dictionary block, which decodeObject
+    // (dictionary.h) decodes.
+    bool decodeBlock(const BlockHeader& header, const unsigned char* body,
+                     unsigned char* out, CodeContext* context = NULL);
+
+    // Returns true if the block described by header, whose payload is at
+    // body, repeats the code of a block before it
+    bool repeatsCode(const BlockHeader& header, const unsigned char* body);
+
+    // Returns true if the block described by header, whose payload is at
+    // body, selects one of the stream's shared codes
+    bool selectsSharedCode(const BlockHeader& header,
+                           const unsigned char* body);
+
+    // Reads the code the block described by header gives for itself into
+    // context, from the first size bytes of its payload at body, which hold
+    // its codebook if they're at least blockChecksumSize + maxCodebookSize
+    // or the whole payload.
+    // Returns false if the block gives no code of its own.
+    bool readBlockCode(const BlockHeader& header, const unsigned char* body,
+                       size_t size, CodeContext& context);
+}
+
+#endif	/* BLOCK_H */
+
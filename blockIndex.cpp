@@ -0,0 +1,174 @@
+/* 
+ * File:   blockIndex.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "blockIndex.h"
+#include "block.h"
+
+#include <cstring>
+
+namespace huffman
+{
+    bool isIndexedFile(const unsigned char* data, size_t size)
+    {
+        return size >= sizeof(fileMagic)
+               && (memcmp(data, frameMagic, sizeof(frameMagic)) == 0
+                   || memcmp(data, fileMagic, sizeof(fileMagic)) == 0
+                   || memcmp(data, skippableMagic, sizeof(skippableMagic))
+                      == 0);
+    }
+
+    void putFrameHeader(const FrameHeader& header, unsigned char* out)
+    {
+        memcpy(out, frameMagic, sizeof(frameMagic));
+        out[4] = frameVersion;
+        out[5] = header.flags;
+        putLE32(out + 6, header.blockSize);
+        putLE64(out + 10, header.contentSize);
+        putLE64(out + 18, header.length);
+    }
+
+    void putSkippableHeader(uint32_t size, unsigned char* out)
+    {
+        memcpy(out, skippableMagic, sizeof(skippableMagic));
+        putLE32(out + 4, size);
+    }
+
+    FrameStatus readFrameHeader(const unsigned char* data, size_t size,
+                                FrameHeader& header)
+    {
+        if (size < sizeof(fileMagic))
+        {
+            // every magic starts "HUF"
+            size_t n = size < 3 ? size : 3;
+            return memcmp(data, frameMagic, n) == 0 ? frameShort
+                                                    : frameUnknown;
+        }
+        if (!isIndexedFile(data, size))
+        {
+            return frameUnknown;
+        }
+        if (memcmp(data, fileMagic, sizeof(fileMagic)) == 0)
+        {
+            header.version = 0;
+            header.flags = 0;
+            header.blockSize = 0;
+            header.contentSize = 0;
+            header.length = 0;
+            header.size = sizeof(fileMagic);
+            return frameOk;
+        }
+        if (memcmp(data, skippableMagic, sizeof(skippableMagic)) == 0)
+        {
+            if (size < skippableHeaderSize)
+            {
+                return frameShort;
+            }
+            header.version = 0;
+            header.flags = 0;
+            header.blockSize = 0;
+            header.contentSize = getLE32(data + 4);
+            header.length = 0;
+            header.size = skippableHeaderSize;
+            return frameSkippable;
+        }
+
+        // a newer version's header may be laid out differently
+        if (size <= 4)
+        {
+            return frameShort;
+        }
+        if (data[4] > frameVersion)
+        {
+            return frameUnsupported;
+        }
+        size_t headerSize = data[4] < 2 ? frameHeaderSizeV1
+                                        : frameHeaderSize;
+        if (size < headerSize)
+        {
+            return frameShort;
+        }
+        header.version = data[4];
+        header.flags = data[5];
+        header.blockSize = getLE32(data + 6);
+        header.contentSize = getLE64(data + 10);
+        header.length = headerSize == frameHeaderSize ? getLE64(data + 18)
+                                                      : 0;
+        header.size = headerSize;
+        if (header.version < 2)
+        {
+            header.flags &= ~frameLength;
+        }
+        return frameOk;
+    }
+
+    void putIndex(const std::vector<IndexEntry>& entries,
+                  std::vector<unsigned char>& out)
+    {
+        size_t start = out.size();
+        out.resize(start + entries.size() * indexEntrySize
+                   + indexTrailerSize);
+        unsigned char* p = out.data() + start;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            putLE64(p, entries[i].offset);
+            putLE32(p + 8, entries[i].rawSize);
+            p += indexEntrySize;
+        }
+        putLE64(p, entries.size());
+        memcpy(p + 8, indexMagic, sizeof(indexMagic));
+    }
+
+    bool readIndexTrailer(const unsigned char* trailer, uint64_t fileSize,
+                          uint64_t dataStart, uint64_t& numBlocks,
+                          uint64_t& indexOffset)
+    {
+        if (memcmp(trailer + 8, indexMagic, sizeof(indexMagic)) != 0)
+        {
+            return false;
+        }
+
+        // every block and its entry take at least a header and an entry
+        numBlocks = getLE64(trailer);
+        if (fileSize < dataStart + indexTrailerSize || numBlocks == 0)
+        {
+            return false;
+        }
+        uint64_t room = fileSize - dataStart - indexTrailerSize;
+        if (numBlocks > room / (blockHeaderSize + indexEntrySize))
+        {
+            return false;
+        }
+
+        indexOffset = fileSize - indexTrailerSize
+                      - numBlocks * indexEntrySize;
+        return true;
+    }
+
+    bool readIndex(const unsigned char* data, uint64_t numBlocks,
+                   uint64_t dataStart, uint64_t indexOffset,
+                   std::vector<IndexEntry>& entries)
+    {
+        entries.resize(numBlocks);
+        uint64_t expected = dataStart;
+        for (uint64_t i = 0; i < numBlocks; i++)
+        {
+            entries[i].offset = getLE64(data + i * indexEntrySize);
+            entries[i].rawSize = getLE32(data + i * indexEntrySize + 8);
+
+            // the first block follows the header, and each one is at least
+            // a header past the last
+            bool badOffset = i == 0 ? entries[i].offset != expected
+                                    : entries[i].offset < expected;
+            if (badOffset || entries[i].offset > indexOffset - blockHeaderSize
+                || entries[i].rawSize > maxBlockSize)
+            {
+                return false;
+            }
+            expected = entries[i].offset + blockHeaderSize;
+        }
+        return true;
+    }
+}
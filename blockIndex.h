@@ -0,0 +1,138 @@
+/* 
+ * File:   blockIndex.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * The layout of an indexed file, which lets its blocks be found and decoded
+ * independently.
+ *
+ * An indexed file is a sequence of frames, each encoded on its own, so
+ * files can be concatenated or appended to. A frame is
+ *     the frame header:
+ *         4 bytes - frameMagic
+ *         1 byte  - the format version, frameVersion
+ *         1 byte  - FrameFlags
+ *         4 bytes - the block size the encoder was given
+ *         8 bytes - the number of bytes the frame decodes to, if the flags
+ *                   say it's given, or 0
+ *         8 bytes - the number of bytes the frame takes, from the start of
+ *                   its header to the end of its trailer, if the flags say
+ *                   it's given, or 0 (from version 2 on)
+ *     a stream of blocks as described in block.h
+ *     the index: for each block in order,
+ *         8 bytes - offset of the block's header from the start of the frame
+ *         4 bytes - number of bytes the block decodes to
+ *     8 bytes - number of blocks in the index
+ *     4 bytes - indexMagic
+ * with every number little-endian. Blocks start on whole bytes, so their
+ * offsets are byte offsets. The frame's length lets a reader find its index
+ * and the next frame without reading any block; version 1 frames, whose
+ * header ends before it, are found by walking their block headers. Files
+ * written before the frame header existed start with fileMagic alone, and
+ * are read as version 0 with no flags.
+ *
+ * Between frames there may also be skippable frames, which hold metadata
+ * that decoders pass over:
+ *     4 bytes - skippableMagic
+ *     4 bytes - the number of bytes of metadata
+ *     the metadata
+ */
+
+#ifndef BLOCKINDEX_H
+#define	BLOCKINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman
+{
+    // No file encoded in the legacy format (huffman.h) can start with 'H':
+    // it would give the first symbol a codeword at least 64 bits long.
+    const unsigned char frameMagic[4] = {'H', 'U', 'F', 'F'};
+    const unsigned char fileMagic[4] = {'H', 'U', 'F', 'B'};
+    const unsigned char indexMagic[4] = {'H', 'U', 'F', 'I'};
+    const unsigned char skippableMagic[4] = {'H', 'U', 'F', 'S'};
+
+    // the newest format version this code reads and the one it writes
+    const unsigned char frameVersion = 2;
+
+    const size_t frameHeaderSize = 26;
+    const size_t frameHeaderSizeV1 = 18; // a version 1 header
+
+    const size_t skippableHeaderSize = 8;
+
+    enum FrameFlags
+    {
+        frameContentSize = 0x01, // the content size is given
+        frameChecksums = 0x02,   // every block has a checksum
+        frameLength = 0x04       // the frame's length is given
+    };
+
+    struct FrameHeader
+    {
+        unsigned char version;
+        unsigned char flags;
+        uint32_t blockSize;
+        uint64_t contentSize; // for a skippable frame, its metadata's size
+        uint64_t length;      // the bytes the whole frame takes, if given
+        size_t size;          // the bytes the header takes in the file
+    };
+
+    enum FrameStatus
+    {
+        frameOk,
+        frameShort,       // more bytes are needed to tell
+        frameUnknown,     // not an indexed file
+        frameUnsupported, // written in a newer version of the format
+        frameSkippable    // a skippable frame
+    };
+
+    const size_t indexEntrySize = 12;
+    const size_t indexTrailerSize = 12;
+
+    struct IndexEntry
+    {
+        uint64_t offset;  // where the block's header starts in the file
+        uint32_t rawSize; // the number of bytes the block decodes to
+    };
+
+    // Returns true if the size bytes at data start with the magic of a
+    // frame: frameMagic, fileMagic or skippableMagic
+    bool isIndexedFile(const unsigned char* data, size_t size);
+
+    // Writes header, of the current version, to out, which has room for
+    // frameHeaderSize bytes
+    void putFrameHeader(const FrameHeader& header, unsigned char* out);
+
+    // Writes the header of a skippable frame of size bytes of metadata to
+    // out, which has room for skippableHeaderSize bytes
+    void putSkippableHeader(uint32_t size, unsigned char* out);
+
+    // Parses the frame header at the start of the size bytes at data. It
+    // takes frameHeaderSize bytes, frameHeaderSizeV1 in version 1, only the
+    // magic in a version 0 file, or skippableHeaderSize bytes for a
+    // skippable frame.
+    FrameStatus readFrameHeader(const unsigned char* data, size_t size,
+                                FrameHeader& header);
+
+    // Appends the index of entries and the trailer to out
+    void putIndex(const std::vector<IndexEntry>& entries,
+                  std::vector<unsigned char>& out);
+
+    // Parses the indexTrailerSize bytes at the end of a fileSize-byte frame
+    // whose blocks start at dataStart, setting numBlocks to the number of
+    // entries in its index and indexOffset to where the index starts.
+    // Returns false if the trailer is invalid.
+    bool readIndexTrailer(const unsigned char* trailer, uint64_t fileSize,
+                          uint64_t dataStart, uint64_t& numBlocks,
+                          uint64_t& indexOffset);
+
+    // Parses the numBlocks entries of an index at data into entries. The
+    // blocks must start at dataStart, follow each other in order and end at
+    // indexOffset. Returns false if they don't.
+    bool readIndex(const unsigned char* data, uint64_t numBlocks,
+                   uint64_t dataStart, uint64_t indexOffset,
+                   std::vector<IndexEntry>& entries);
+}
+
+#endif	/* BLOCKINDEX_H */
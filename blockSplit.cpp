@@ -0,0 +1,137 @@
+/* 
+ * File:   blockSplit.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "blockSplit.h"
+#include "block.h"
+#include "codebook.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace huffman
+{
+    namespace
+    {
+        // Returns the number of bits an ideal code takes for symbols with
+        // the given counts, plus the header and compact codebook of a block
+        // holding them
+        double blockBits(const uint64_t* counts)
+        {
+            uint64_t total = 0;
+            double bits = 0;
+            unsigned int present = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                if (counts[c] > 0)
+                {
+                    total += counts[c];
+                    bits -= counts[c] * std::log2((double)counts[c]);
+                    present++;
+                }
+            }
+            if (total > 0)
+            {
+                bits += total * std::log2((double)total);
+            }
+            return bits + (blockHeaderSize + 1 + numSymbols / 8) * 8
+                   + present * 5;
+        }
+    }
+
+    size_t chooseBlockEnd(const unsigned char* in, size_t size,
+                          uint64_t* counts)
+    {
+        size = size < maxBlockSize ? size : maxBlockSize;
+        size_t numGranules = (size + splitGranule - 1) / splitGranule;
+        if (numGranules <= 1)
+        {
+            if (counts)
+            {
+                memset(counts, 0, numSymbols * sizeof(uint64_t));
+                countChars(in, size, counts);
+            }
+            return size;
+        }
+
+        // only the granules still in a lookahead are kept, each counted as
+        // it comes into one; granule g sits in slot g % window
+        const size_t window = splitLookahead + 1;
+        uint64_t granules[window][numSymbols];
+        auto count = [&](size_t g)
+        {
+            size_t start = g * splitGranule;
+            size_t n = size - start < splitGranule ? size - start
+                                                   : splitGranule;
+            memset(granules[g % window], 0, sizeof(granules[0]));
+            countChars(in + start, n, granules[g % window]);
+        };
+
+        // left is the block so far, right the lookahead after it
+        uint64_t left[numSymbols];
+        uint64_t right[numSymbols] = {0};
+        count(0);
+        memcpy(left, granules[0], sizeof(left));
+        for (size_t k = 1; k <= splitLookahead && k < numGranules; k++)
+        {
+            count(k);
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                right[c] += granules[k % window][c];
+            }
+        }
+
+        // a profitable split might be early, its lookahead reaching into
+        // the change; the best of the next few candidates is taken
+        size_t best = 0;
+        double bestSaving = 0;
+        for (size_t g = 1; g < numGranules; g++)
+        {
+            if (best > 0 && g >= best + splitLookahead)
+            {
+                break;
+            }
+
+            // granule g - 1 moves from the lookahead into the block
+            if (g > 1)
+            {
+                size_t next = g + splitLookahead - 1;
+                if (next < numGranules)
+                {
+                    count(next);
+                }
+                for (unsigned int c = 0; c < numSymbols; c++)
+                {
+                    left[c] += granules[(g - 1) % window][c];
+                    right[c] -= granules[(g - 1) % window][c];
+                    right[c] += next < numGranules ? granules[next % window][c]
+                                                   : 0;
+                }
+            }
+
+            uint64_t both[numSymbols];
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                both[c] = left[c] + right[c];
+            }
+            double saving = blockBits(both) - blockBits(left)
+                            - blockBits(right);
+            if (saving > bestSaving)
+            {
+                best = g;
+                bestSaving = saving;
+                if (counts)
+                {
+                    memcpy(counts, left, sizeof(left));
+                }
+            }
+            else if (best == 0 && counts && g == numGranules - 1)
+            {
+                // no split: the block is all of it
+                memcpy(counts, both, sizeof(both));
+            }
+        }
+        return best > 0 ? best * splitGranule : size;
+    }
+}
@@ -0,0 +1,48 @@
+/* 
+ * File:   blockSplit.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Chooses where blocks end, so that each gets a code suited to its content.
+ */
+
+#ifndef BLOCKSPLIT_H
+#define	BLOCKSPLIT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman
+{
+    // blocks are only split at multiples of this many bytes
+    const size_t splitGranule = 1 << 12;
+
+    // the number of granules after a candidate split that it's judged on
+    const size_t splitLookahead = 4;
+
+    /*
+    Returns the number of bytes of the size bytes at in that the next block
+    should take: all of them, unless the statistics change enough partway
+    that a new code would pay for its header.
+
+    The input is histogrammed a splitGranule at a time. Growing the block a
+    granule at a time, each granule boundary is a candidate split, judged
+    on the splitLookahead granules after it: it's taken if the entropy of
+    the block so far plus that of the granules after it, plus a block
+    header and codebook, is less than the entropy of the two together. As
+    the lookahead of a candidate before a change already reaches into it,
+    the candidate saving the most of it and the few after it is chosen.
+    Each byte is counted once and each candidate costs two 256-entry
+    entropy sums, whatever the content. Only the histograms of the granules
+    in the lookahead are kept, on the stack, so nothing is allocated and
+    little stack is used, and a block never takes more than maxBlockSize
+    bytes.
+
+    If counts is given, it's set to the byte counts of the block chosen, for
+    encodeBlock to take rather than counting the block again. Bytes left
+    for a later block are counted again when it's chosen.
+    */
+    size_t chooseBlockEnd(const unsigned char* in, size_t size,
+                          uint64_t* counts = NULL);
+}
+
+#endif	/* BLOCKSPLIT_H */
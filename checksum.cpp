@@ -0,0 +1,93 @@
+/* 
+ * File:   checksum.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "checksum.h"
+#include "dispatch.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace huffman
+{
+    namespace
+    {
+        // the reflected Castagnoli polynomial
+        const uint32_t polynomial = 0x82F63B78;
+
+        constexpr Crc32cTables makeTables()
+        {
+            Crc32cTables tables = {};
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                uint32_t c = b;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    c = c & 1 ? (c >> 1) ^ polynomial : c >> 1;
+                }
+                tables.slices[0][b] = c;
+            }
+            for (int k = 1; k < 8; k++)
+            {
+                for (int b = 0; b < 256; b++)
+                {
+                    uint32_t c = tables.slices[k - 1][b];
+                    tables.slices[k][b] = (c >> 8)
+                                          ^ tables.slices[0][c & 0xFF];
+                }
+            }
+            return tables;
+        }
+    }
+
+    const Crc32cTables crc32cTables = makeTables();
+
+    uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc)
+    {
+        return kernels().crc32c(data, size, crc);
+    }
+
+    void countCharsCrc(const unsigned char* data, size_t size,
+                       uint64_t* counts, uint32_t& crc)
+    {
+        kernels().countCharsCrc(data, size, counts, crc);
+    }
+
+    uint32_t crc32cScalar(const unsigned char* data, size_t size,
+                          uint32_t crc)
+    {
+        uint32_t c = ~crc;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            c = crc32cWord(c, word);
+        }
+        for (; i < size; i++)
+        {
+            c = crc32cByte(c, data[i]);
+        }
+        return ~c;
+    }
+
+    __attribute__((target("sse4.2")))
+    uint32_t crc32cSse42(const unsigned char* data, size_t size,
+                         uint32_t crc)
+    {
+        uint64_t c = ~crc;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            c = _mm_crc32_u64(c, word);
+        }
+        for (; i < size; i++)
+        {
+            c = _mm_crc32_u8(c, data[i]);
+        }
+        return ~(uint32_t)c;
+    }
+}
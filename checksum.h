@@ -0,0 +1,60 @@
+/* 
+ * File:   checksum.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * CRC-32C (Castagnoli) checksums of the data blocks decode to.
+ */
+
+#ifndef CHECKSUM_H
+#define	CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman
+{
+    // Returns the CRC-32C of the size bytes at data, continuing from crc, the
+    // CRC-32C of the bytes before them (0 if there are none)
+    uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+    // Adds the occurrences of each byte in data to counts, like countChars
+    // (codebook.h), and continues crc over data like crc32c, in one pass
+    void countCharsCrc(const unsigned char* data, size_t size,
+                       uint64_t* counts, uint32_t& crc);
+
+    // The variants of crc32c. The scalar one goes 8 bytes at a time through
+    // the tables below; the other uses the SSE4.2 crc32 instruction.
+    uint32_t crc32cScalar(const unsigned char* data, size_t size,
+                          uint32_t crc);
+    uint32_t crc32cSse42(const unsigned char* data, size_t size,
+                         uint32_t crc);
+
+    // slices[k][b] is the CRC of byte b followed by k zero bytes, with no
+    // pre- or post-inversion
+    struct Crc32cTables
+    {
+        uint32_t slices[8][256];
+    };
+
+    extern const Crc32cTables crc32cTables;
+
+    // Continues the uninverted CRC c over the little-endian 8 bytes of word
+    inline uint32_t crc32cWord(uint32_t c, uint64_t word)
+    {
+        const uint32_t (*t)[256] = crc32cTables.slices;
+        uint32_t low = c ^ (uint32_t)word;
+        uint32_t high = word >> 32;
+        return t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF]
+               ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+               ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF]
+               ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+
+    // Continues the uninverted CRC c over byte
+    inline uint32_t crc32cByte(uint32_t c, unsigned char byte)
+    {
+        return crc32cTables.slices[0][(c ^ byte) & 0xFF] ^ (c >> 8);
+    }
+}
+
+#endif	/* CHECKSUM_H */
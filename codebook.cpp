@@ -0,0 +1,258 @@
+/* 
+ * File:   codebook.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "codebook.h"
+#include "dispatch.h"
+#include "node.h"
+
+namespace huffman
+{
+    namespace
+    {
+        class freqCompare
+        {
+        public:
+            bool operator() (const node* a, const node* b)
+            {
+                return a->freq > b->freq;
+            }
+        };
+        
+        bool codewordCompare(const codeword& a, const codeword& b)
+        {
+            if(a.bits < b.bits) // sort first by code length
+            {
+                return true;
+            }
+            else if(a.bits > b.bits)
+            {
+                return false;
+            }
+            else if(a.sym <= b.sym) // ...then by symbol
+            {
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+
+    void countChars(const unsigned char* data, size_t size, uint64_t* counts)
+    {
+        kernels().countChars(data, size, counts);
+    }
+    
+    node* constructTree(const uint64_t* counts, node* pool)
+    {
+        uint64_t total = 0;
+        for(unsigned int c = 0; c < numSymbols; c++)
+        {
+            total += counts[c];
+        }
+        if(total == 0)
+        {
+            return NULL;
+        }
+        
+        // first create a leaf node for each symbol and add it to a
+        // priority queue, kept as a heap in a fixed array
+        node* pq[numSymbols];
+        unsigned int pqSize = 0;
+        unsigned int poolSize = 0;
+        freqCompare compare;
+        
+        for(unsigned int c = 0; c < numSymbols; c++)
+        {
+            if(counts[c] == 0)
+            {
+                continue;
+            }
+            
+            double freq = (double)counts[c] / total;
+            
+            node* newnode = &pool[poolSize++];
+            *newnode = node(freq, (char)c);
+            
+            pq[pqSize++] = newnode;
+            std::push_heap(pq, pq + pqSize, compare);
+        }
+        
+        // pop nodes from queue to construct Huffman tree
+        while(pqSize > 1)
+        {
+            std::pop_heap(pq, pq + pqSize--, compare);
+            node* a = pq[pqSize];
+            std::pop_heap(pq, pq + pqSize--, compare);
+            node* b = pq[pqSize];
+            
+            node* internalNode = &pool[poolSize++];
+            *internalNode = node(a, b);
+            pq[pqSize++] = internalNode;
+            std::push_heap(pq, pq + pqSize, compare);
+        }
+        node* root = pq[0];
+        
+        return root;
+    }
+    
+    void getCodewords(codeword* words,
+                      unsigned int& numWords,
+                      const node& root,
+                      codeword currWord)
+    {
+        if(root.children[0] == NULL && root.children[1] == NULL)
+        {
+            // we're at a leaf!
+            currWord.sym = root.sym;
+            words[numWords++] = currWord;
+            return;
+        }
+        else
+        {
+            // neither child is NULL, since an internal node MUST be
+            // constructed with 2 children
+            
+            codeword childWord;
+            childWord.bits = currWord.bits + 1;
+            childWord.code = currWord.code << 1;
+            
+            // before pushing a codeword into words,
+            // codeword.sym is initialized, so childWord.sym doesn't matter.
+            // To get the compiler to be quiet, let's just initialize to 0.
+            childWord.sym = 0;
+            
+            getCodewords(words, numWords, *(root.children[0]), childWord);
+            
+            childWord.code++;
+            getCodewords(words, numWords, *(root.children[1]), childWord);
+        }
+    }
+    
+    void canonize(codeword* words, unsigned int numWords, CodeTable& table)
+    {
+        memset(&table, 0, sizeof(table));
+        if(numWords == 0)
+        {
+            return;
+        }
+        
+        std::sort(words, words + numWords, codewordCompare);
+        
+        // A tree with a single leaf gives its symbol an empty codeword,
+        // which couldn't be told apart from an absent symbol. Spend a bit.
+        if(numWords == 1)
+        {
+            words[0].bits = 1;
+        }
+        
+        words[0].code = 0; // first word is zero
+        for(unsigned int i = 1; i < numWords; i++)
+        {
+            // each word is one greater than last
+            words[i].code = words[i-1].code + 1;
+            
+            // if a word is longer than the previous one,
+            // left shift until it's the appropriate length
+            if(words[i].bits > words[i-1].bits)
+            {
+                words[i].code <<= words[i].bits - words[i-1].bits;
+            }
+        }
+        
+        for(unsigned int i = 0; i < numWords; i++)
+        {
+            table.codes[words[i].sym] = words[i].code;
+            table.lens[words[i].sym] = words[i].bits;
+        }
+        table.maxBits = words[numWords - 1].bits;
+    }
+    
+    void buildCodeTable(const uint64_t* counts, CodeTable& table)
+    {
+        node pool[maxTreeNodes];
+        codeword words[numSymbols];
+        unsigned int numWords = 0;
+        
+        node* root = constructTree(counts, pool);
+        if(root)
+        {
+            codeword initWord;
+            initWord.code = initWord.bits = initWord.sym = 0;
+            
+            getCodewords(words, numWords, *root, initWord);
+        }
+        
+        canonize(words, numWords, table);
+    }
+    
+    void buildCodeTable(const CanonicalCode& code, CodeTable& table)
+    {
+        memset(&table, 0, sizeof(table));
+        for(unsigned int len = 1; len <= code.maxBits; len++)
+        {
+            for(unsigned int i = 0; i < code.count[len]; i++)
+            {
+                unsigned char sym = code.symbols[code.index[len] + i];
+                table.codes[sym] = code.first[len] + i;
+                table.lens[sym] = len;
+            }
+        }
+        table.maxBits = code.maxBits;
+    }
+    
+    bool buildCanonicalCode(const unsigned char* lengths,
+                            unsigned int numLengths,
+                            CanonicalCode& code)
+    {
+        memset(&code, 0, sizeof(code));
+        
+        for(unsigned int c = 0; c < numLengths; c++)
+        {
+            if(lengths[c] > maxCodeBits)
+            {
+                return false;
+            }
+            code.count[lengths[c]]++;
+            code.maxBits = std::max<unsigned int>(code.maxBits, lengths[c]);
+        }
+        code.count[0] = 0;
+        
+        // assign the first codeword of each length the way canonize does,
+        // checking that no codeword runs out of bits
+        uint64_t next = 0;
+        for(unsigned int len = 1; len <= maxCodeBits; len++)
+        {
+            code.first[len] = next;
+            code.index[len] = code.numCodes;
+            next += code.count[len];
+            code.limit[len] = next;
+            code.numCodes += code.count[len];
+            
+            if(next > ((uint64_t)1 << len))
+            {
+                return false;
+            }
+            next <<= 1;
+        }
+        
+        // list the symbols in canonical order
+        unsigned int filled[maxCodeBits + 1] = {0};
+        for(unsigned int c = 0; c < numLengths; c++)
+        {
+            unsigned int len = lengths[c];
+            if(len > 0)
+            {
+                code.symbols[code.index[len] + filled[len]++] = c;
+            }
+        }
+        
+        return true;
+    }
+}
@@ -0,0 +1,105 @@
+/* 
+ * File:   codebook.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Builds canonical Huffman codebooks from symbol counts.
+ */
+
+#ifndef CODEBOOK_H
+#define	CODEBOOK_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "node.h"
+
+namespace huffman
+{
+    // the number of distinct symbols (byte values) a codebook describes
+    const unsigned int numSymbols = 256;
+
+    // the longest codeword that fits in a CodeTable entry
+    const unsigned int maxCodeBits = 32;
+
+    // the most nodes a Huffman tree over numSymbols symbols can have
+    const unsigned int maxTreeNodes = 2 * numSymbols - 1;
+
+    struct codeword
+    {
+        unsigned char sym;
+        unsigned int code;
+        unsigned char bits; // number of bits in code
+    };
+
+    /*
+    Flat codebook indexed by symbol. Codes and lengths are kept in separate
+    arrays of equal-width entries so that the vector kernels can gather either
+    one with a single instruction. A length of 0 means the symbol is absent.
+    */
+    struct CodeTable
+    {
+        uint32_t codes[numSymbols];
+        uint32_t lens[numSymbols];
+
+        // the length of the longest codeword in the table
+        unsigned int maxBits;
+    };
+
+    /*
+    A canonical code described by its codeword lengths alone, arranged for
+    decoding: codewords of each length are consecutive numbers, so a
+    codeword of len bits is the one whose top len bits are below
+    limit[len], and it belongs to symbols[index[len] + code - first[len]].
+    */
+    struct CanonicalCode
+    {
+        uint32_t first[maxCodeBits + 1];
+        uint64_t limit[maxCodeBits + 1];
+        uint32_t index[maxCodeBits + 1];
+
+        // the number of codewords of each length
+        uint32_t count[maxCodeBits + 1];
+
+        // symbols sorted by codeword length, then by symbol
+        unsigned char symbols[numSymbols];
+
+        unsigned int numCodes;
+        unsigned int maxBits;
+    };
+
+    // Builds code from the codeword lengths of symbols 0 to numLengths - 1,
+    // where 0 means the symbol is absent. Returns false if the lengths don't
+    // describe a prefix code.
+    bool buildCanonicalCode(const unsigned char* lengths,
+                            unsigned int numLengths,
+                            CanonicalCode& code);
+
+    // adds the number of occurrences of each byte in data to counts, which
+    // must have numSymbols entries
+    void countChars(const unsigned char* data, size_t size, uint64_t* counts);
+
+    // builds the Huffman tree for counts out of the maxTreeNodes nodes in
+    // pool and returns its root, or NULL if every count is 0
+    node* constructTree(const uint64_t* counts, node* pool);
+
+    // appends to words (which has room for numSymbols codewords) the
+    // symbol-code pairs produced by traversing the tree rooted with given
+    // root, counting them in numWords
+    void getCodewords(codeword* words,
+                      unsigned int& numWords,
+                      const node& root,
+                      codeword currWord);
+
+    // turns any Huffman code into a canonical one and stores it in table
+    void canonize(codeword* words, unsigned int numWords, CodeTable& table);
+
+    // runs constructTree, getCodewords and canonize over counts to fill table.
+    // If every count is 0, table is left empty. Doesn't allocate memory.
+    void buildCodeTable(const uint64_t* counts, CodeTable& table);
+
+    // fills table with the codewords of code
+    void buildCodeTable(const CanonicalCode& code, CodeTable& table);
+}
+
+#endif	/* CODEBOOK_H */
+
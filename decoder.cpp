@@ -0,0 +1,682 @@
+/* 
+ * File:   decoder.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "decoder.h"
+#include "bitReader.h"
+#include "dispatch.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace huffman
+{
+    namespace
+    {
+        // the longest average codeword length, in bits, at which
+        // preferMultiDecode picks a MultiDecodeTable
+        const unsigned int multiMaxAverageBits = 5;
+
+        // the name of the environment variable that forces a DecodeMethod
+        const char* const methodVariable = "HUFFMAN_DECODER";
+
+        const char* const methodNames[numDecodeMethods] = {
+            "lookup", "multi", "fsm"
+        };
+
+        // Returns the method methodVariable names, or numDecodeMethods if
+        // it names none
+        DecodeMethod forcedMethod()
+        {
+            const char* forced = getenv(methodVariable);
+            if (forced)
+            {
+                for (int m = 0; m < numDecodeMethods; m++)
+                {
+                    if (strcmp(forced, methodNames[m]) == 0)
+                    {
+                        return (DecodeMethod)m;
+                    }
+                }
+            }
+            return numDecodeMethods;
+        }
+
+        // Returns the 64 bits starting at bit pos of data, which must have
+        // 8 bytes from byte pos / 8 on. Only the first 57 are guaranteed to
+        // be whole.
+        inline uint64_t loadBits(const unsigned char* data, size_t pos)
+        {
+            uint64_t word;
+            memcpy(&word, data + (pos >> 3), sizeof(word));
+            return __builtin_bswap64(word) << (pos & 7);
+        }
+
+        // Sets bit i of the bitset marks
+        inline void setMark(uint64_t* marks, size_t i)
+        {
+            marks[i >> 6] |= (uint64_t)1 << (i & 63);
+        }
+
+        // Decodes the codeword at the top of window, which holds at least
+        // code.maxBits bits, by walking code one length at a time from
+        // minLen, below which it's known not to have a codeword. Returns
+        // its symbol and sets len to its length, or returns -1 if window
+        // doesn't start with a codeword.
+        inline int decodeLong(const CanonicalCode& code, uint64_t window,
+                              unsigned int minLen, unsigned int& len)
+        {
+            for (len = minLen; len <= code.maxBits; len++)
+            {
+                uint64_t bits = window >> (64 - len);
+                if (bits < code.limit[len])
+                {
+                    return code.symbols[code.index[len] + bits
+                                        - code.first[len]];
+                }
+            }
+            return -1;
+        }
+
+        // Decodes the codeword at bit bitPos of the size bytes at data,
+        // setting sym to its symbol. Returns its length, or 0 if no codeword
+        // starts there.
+        inline unsigned int decodeOne(const DecodeTable& table,
+                                      const unsigned char* data, size_t size,
+                                      size_t bitPos, unsigned char& sym)
+        {
+            BitReader in(data, size, bitPos);
+            DecodeEntry e = table.entries[in.peek(table.bits)];
+            if (e.len > 0)
+            {
+                sym = e.sym;
+                return e.len;
+            }
+
+            unsigned int len;
+            int longSym = decodeLong(table.code, in.peek(57) << 7,
+                                     table.bits + 1, len);
+            if (longSym < 0)
+            {
+                return 0;
+            }
+            sym = longSym;
+            return len;
+        }
+
+        /*
+        Each refill loads 8 bytes, of which at least 57 bits are usable, so
+        57 / table.bits first-level lookups can be done before the next
+        refill. The steady state runs while that many symbols, 64 bits of
+        input and 8 readable bytes remain; an entry for a longer codeword
+        breaks out of the refill to walk the second level from a fresh
+        window. The tail decodes one careful symbol at a time.
+        */
+        __attribute__((always_inline))
+        inline size_t decodeTable(const DecodeTable& table,
+                                  const unsigned char* data, size_t size,
+                                  size_t& bitPos, size_t endBit,
+                                  unsigned char* out, size_t maxOut)
+        {
+            const DecodeEntry* entries = table.entries;
+            const unsigned int bits = table.bits;
+            const unsigned int shift = 64 - bits;
+            const unsigned int perRefill = 57 / bits;
+
+            size_t pos = bitPos;
+            size_t n = 0;
+
+            size_t fastEnd = 0;
+            if (size >= 8 && endBit >= 64)
+            {
+                fastEnd = (size - 8) * 8 < endBit - 64 ? (size - 8) * 8
+                                                       : endBit - 64;
+            }
+
+            while (pos < fastEnd && n + perRefill <= maxOut)
+            {
+                uint64_t acc = loadBits(data, pos);
+                unsigned int k = 0;
+                for (; k < perRefill; k++)
+                {
+                    DecodeEntry e = entries[acc >> shift];
+                    if (e.len == 0)
+                    {
+                        break;
+                    }
+                    out[n++] = e.sym;
+                    acc <<= e.len;
+                    pos += e.len;
+                }
+
+                if (k < perRefill)
+                {
+                    // the window has to be refilled within the fast range
+                    if (pos >= fastEnd)
+                    {
+                        break;
+                    }
+                    unsigned int len;
+                    int sym = decodeLong(table.code, loadBits(data, pos),
+                                         bits + 1, len);
+                    if (sym < 0)
+                    {
+                        bitPos = pos;
+                        return n;
+                    }
+                    out[n++] = sym;
+                    pos += len;
+                }
+            }
+
+            BitReader in(data, size, pos);
+            while (n < maxOut && in.bitPos() < endBit)
+            {
+                DecodeEntry e = entries[in.peek(bits)];
+                if (e.len > 0)
+                {
+                    out[n++] = e.sym;
+                    in.consume(e.len);
+                    continue;
+                }
+
+                unsigned int len;
+                int sym = decodeLong(table.code, in.peek(57) << 7, bits + 1,
+                                     len);
+                if (sym < 0)
+                {
+                    break;
+                }
+                out[n++] = sym;
+                in.consume(len);
+            }
+
+            bitPos = in.bitPos();
+            return n;
+        }
+
+        /*
+        Works like decodeTable, but an entry can emit up to maxMultiSymbols
+        symbols, which are all stored at once, so the steady state needs
+        room for that many per lookup. Entries without a whole codeword
+        break out of the refill to decode a long codeword from a fresh
+        window. The tail only uses entries whose symbols all fit, and
+        decodes the rest one symbol at a time.
+        */
+        __attribute__((always_inline))
+        inline size_t decodeMultiTable(const MultiDecodeTable& table,
+                                       const unsigned char* data, size_t size,
+                                       size_t& bitPos, size_t endBit,
+                                       unsigned char* out, size_t maxOut)
+        {
+            const MultiEntry* entries = table.entries;
+            const unsigned int shift = 64 - multiTableBits;
+            const unsigned int perRefill = 57 / multiTableBits;
+            const size_t refillOut = perRefill * maxMultiSymbols;
+
+            size_t pos = bitPos;
+            size_t n = 0;
+
+            size_t fastEnd = 0;
+            if (size >= 8 && endBit >= 64)
+            {
+                fastEnd = (size - 8) * 8 < endBit - 64 ? (size - 8) * 8
+                                                       : endBit - 64;
+            }
+
+            while (pos < fastEnd && n + refillOut <= maxOut)
+            {
+                uint64_t acc = loadBits(data, pos);
+                unsigned int k = 0;
+                for (; k < perRefill; k++)
+                {
+                    const MultiEntry& e = entries[acc >> shift];
+                    if (e.count == 0)
+                    {
+                        break;
+                    }
+                    memcpy(out + n, e.syms, maxMultiSymbols);
+                    n += e.count;
+                    acc <<= e.len;
+                    pos += e.len;
+                }
+
+                if (k < perRefill)
+                {
+                    // the window has to be refilled within the fast range
+                    if (pos >= fastEnd)
+                    {
+                        break;
+                    }
+                    unsigned int len;
+                    int sym = decodeLong(table.code, loadBits(data, pos),
+                                         multiTableBits + 1, len);
+                    if (sym < 0)
+                    {
+                        bitPos = pos;
+                        return n;
+                    }
+                    out[n++] = sym;
+                    pos += len;
+                }
+            }
+
+            BitReader in(data, size, pos);
+            while (n < maxOut && in.bitPos() < endBit)
+            {
+                const MultiEntry& e = entries[in.peek(multiTableBits)];
+                if (e.count > 0 && e.count <= maxOut - n
+                    && in.bitPos() + e.len <= endBit)
+                {
+                    memcpy(out + n, e.syms, e.count);
+                    n += e.count;
+                    in.consume(e.len);
+                    continue;
+                }
+
+                unsigned int len;
+                int sym = decodeLong(table.code, in.peek(57) << 7, 1, len);
+                if (sym < 0)
+                {
+                    break;
+                }
+                out[n++] = sym;
+                in.consume(len);
+            }
+
+            bitPos = in.bitPos();
+            return n;
+        }
+
+        /*
+        Decodes numStreams streams in lockstep, each with its own cursor.
+        Every refill reloads all four windows and then takes perRefill
+        symbols from each in turn, so the four lookup chains overlap. With
+        every codeword in the first level there's nothing to branch on in
+        the steady state: an invalid pattern (an entry of length 0) is only
+        noted, and reported once the loop is done. The epilogue decodes the
+        rest one careful symbol at a time.
+        */
+        __attribute__((always_inline))
+        inline bool decodeInterleavedTable(const DecodeTable& table,
+                                           const unsigned char* const* streams,
+                                           const size_t* sizes,
+                                           unsigned char* out, size_t size)
+        {
+            const DecodeEntry* entries = table.entries;
+            const unsigned int bits = table.bits;
+            const unsigned int shift = 64 - bits;
+            const unsigned int perRefill = 57 / bits;
+
+            const unsigned char* d0 = streams[0];
+            const unsigned char* d1 = streams[1];
+            const unsigned char* d2 = streams[2];
+            const unsigned char* d3 = streams[3];
+            size_t p0 = 0, p1 = 0, p2 = 0, p3 = 0;
+            size_t n = 0;
+            bool invalid = false;
+
+            // every cursor must have 8 readable bytes at each refill
+            size_t fastEnd = SIZE_MAX;
+            for (unsigned int s = 0; s < numStreams; s++)
+            {
+                size_t end = sizes[s] >= 8 ? (sizes[s] - 8) * 8 : 0;
+                fastEnd = end < fastEnd ? end : fastEnd;
+            }
+
+            if (table.code.maxBits <= bits)
+            {
+                while (n + numStreams * perRefill <= size && p0 < fastEnd
+                       && p1 < fastEnd && p2 < fastEnd && p3 < fastEnd)
+                {
+                    uint64_t a0 = loadBits(d0, p0);
+                    uint64_t a1 = loadBits(d1, p1);
+                    uint64_t a2 = loadBits(d2, p2);
+                    uint64_t a3 = loadBits(d3, p3);
+                    for (unsigned int k = 0; k < perRefill; k++)
+                    {
+                        DecodeEntry e0 = entries[a0 >> shift];
+                        DecodeEntry e1 = entries[a1 >> shift];
+                        DecodeEntry e2 = entries[a2 >> shift];
+                        DecodeEntry e3 = entries[a3 >> shift];
+                        out[n] = e0.sym;
+                        out[n + 1] = e1.sym;
+                        out[n + 2] = e2.sym;
+                        out[n + 3] = e3.sym;
+                        invalid |= (e0.len == 0) | (e1.len == 0)
+                                   | (e2.len == 0) | (e3.len == 0);
+                        a0 <<= e0.len;
+                        a1 <<= e1.len;
+                        a2 <<= e2.len;
+                        a3 <<= e3.len;
+                        p0 += e0.len;
+                        p1 += e1.len;
+                        p2 += e2.len;
+                        p3 += e3.len;
+                        n += numStreams;
+                    }
+                }
+            }
+
+            size_t pos[numStreams] = {p0, p1, p2, p3};
+            for (; n < size; n++)
+            {
+                unsigned int s = n % numStreams;
+                unsigned int len = decodeOne(table, streams[s], sizes[s],
+                                             pos[s], out[n]);
+                if (len == 0)
+                {
+                    return false;
+                }
+                pos[s] += len;
+            }
+
+            for (unsigned int s = 0; s < numStreams; s++)
+            {
+                invalid |= pos[s] > sizes[s] * 8;
+            }
+            return !invalid;
+        }
+    }
+
+    bool buildDecodeTable(const CanonicalCode& code, DecodeTable& table)
+    {
+        if (code.numCodes == 0)
+        {
+            return false;
+        }
+
+        table.code = code;
+        table.bits = code.maxBits < decodeTableBits ? code.maxBits
+                                                    : decodeTableBits;
+        size_t tableSize = (size_t)1 << table.bits;
+        size_t filled = 0;
+
+        // Codewords in canonical order cover the table from the start; each
+        // fills the entries of every bit pattern it's a prefix of.
+        for (unsigned int len = 1; len <= table.bits; len++)
+        {
+            size_t span = (size_t)1 << (table.bits - len);
+            for (unsigned int i = 0; i < code.count[len]; i++)
+            {
+                DecodeEntry e;
+                e.sym = code.symbols[code.index[len] + i];
+                e.len = len;
+                for (size_t j = 0; j < span; j++)
+                {
+                    table.entries[filled++] = e;
+                }
+            }
+        }
+
+        // The rest start longer codewords, or can't appear in valid input;
+        // either way they're left to the second level.
+        DecodeEntry second = {0, 0};
+        while (filled < tableSize)
+        {
+            table.entries[filled++] = second;
+        }
+        return true;
+    }
+
+    void buildMultiDecodeTable(const CanonicalCode& code,
+                               MultiDecodeTable& table)
+    {
+        table.code = code;
+
+        // Decode each bit pattern greedily until the next codeword doesn't
+        // fit in what's left of it
+        const size_t tableSize = (size_t)1 << multiTableBits;
+        for (size_t i = 0; i < tableSize; i++)
+        {
+            uint64_t window = (uint64_t)i << (64 - multiTableBits);
+            MultiEntry& e = table.entries[i];
+            memset(&e, 0, sizeof(e));
+            while (e.count < maxMultiSymbols)
+            {
+                unsigned int len;
+                int sym = decodeLong(code, window << e.len, 1, len);
+                if (sym < 0 || e.len + len > multiTableBits)
+                {
+                    break;
+                }
+                e.syms[e.count++] = sym;
+                e.len += len;
+            }
+        }
+    }
+
+    bool preferMultiDecode(const CanonicalCode& code)
+    {
+        // A complete code's average length, if every symbol had the
+        // probability its codeword length implies, in 1/2^maxCodeBits bits
+        uint64_t average = 0;
+        for (unsigned int len = 1; len <= code.maxBits; len++)
+        {
+            average += (uint64_t)code.count[len] * len << (maxCodeBits - len);
+        }
+        return average <= (uint64_t)multiMaxAverageBits << maxCodeBits;
+    }
+
+    DecodeMethod decodeMethod(const CanonicalCode& code)
+    {
+        static const DecodeMethod forced = forcedMethod();
+        if (forced != numDecodeMethods)
+        {
+            return forced;
+        }
+        return preferMultiDecode(code) ? methodMulti : methodLookup;
+    }
+
+    size_t decodeSymbolsScalar(const DecodeTable& table,
+                               const unsigned char* data, size_t size,
+                               size_t& bitPos, size_t endBit,
+                               unsigned char* out, size_t maxOut)
+    {
+        return decodeTable(table, data, size, bitPos, endBit, out, maxOut);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    size_t decodeSymbolsSse42(const DecodeTable& table,
+                              const unsigned char* data, size_t size,
+                              size_t& bitPos, size_t endBit,
+                              unsigned char* out, size_t maxOut)
+    {
+        return decodeTable(table, data, size, bitPos, endBit, out, maxOut);
+    }
+
+    __attribute__((target("avx2,bmi2")))
+    size_t decodeSymbolsAvx2(const DecodeTable& table,
+                             const unsigned char* data, size_t size,
+                             size_t& bitPos, size_t endBit,
+                             unsigned char* out, size_t maxOut)
+    {
+        return decodeTable(table, data, size, bitPos, endBit, out, maxOut);
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    size_t decodeSymbolsAvx512(const DecodeTable& table,
+                               const unsigned char* data, size_t size,
+                               size_t& bitPos, size_t endBit,
+                               unsigned char* out, size_t maxOut)
+    {
+        return decodeTable(table, data, size, bitPos, endBit, out, maxOut);
+    }
+
+    size_t decodeMultiSymbolsScalar(const MultiDecodeTable& table,
+                                    const unsigned char* data, size_t size,
+                                    size_t& bitPos, size_t endBit,
+                                    unsigned char* out, size_t maxOut)
+    {
+        return decodeMultiTable(table, data, size, bitPos, endBit, out,
+                                maxOut);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    size_t decodeMultiSymbolsSse42(const MultiDecodeTable& table,
+                                   const unsigned char* data, size_t size,
+                                   size_t& bitPos, size_t endBit,
+                                   unsigned char* out, size_t maxOut)
+    {
+        return decodeMultiTable(table, data, size, bitPos, endBit, out,
+                                maxOut);
+    }
+
+    __attribute__((target("avx2,bmi2")))
+    size_t decodeMultiSymbolsAvx2(const MultiDecodeTable& table,
+                                  const unsigned char* data, size_t size,
+                                  size_t& bitPos, size_t endBit,
+                                  unsigned char* out, size_t maxOut)
+    {
+        return decodeMultiTable(table, data, size, bitPos, endBit, out,
+                                maxOut);
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    size_t decodeMultiSymbolsAvx512(const MultiDecodeTable& table,
+                                    const unsigned char* data, size_t size,
+                                    size_t& bitPos, size_t endBit,
+                                    unsigned char* out, size_t maxOut)
+    {
+        return decodeMultiTable(table, data, size, bitPos, endBit, out,
+                                maxOut);
+    }
+
+    bool decodeInterleavedScalar(const DecodeTable& table,
+                                 const unsigned char* const* streams,
+                                 const size_t* sizes, unsigned char* out,
+                                 size_t size)
+    {
+        return decodeInterleavedTable(table, streams, sizes, out, size);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    bool decodeInterleavedSse42(const DecodeTable& table,
+                                const unsigned char* const* streams,
+                                const size_t* sizes, unsigned char* out,
+                                size_t size)
+    {
+        return decodeInterleavedTable(table, streams, sizes, out, size);
+    }
+
+    __attribute__((target("avx2,bmi2")))
+    bool decodeInterleavedAvx2(const DecodeTable& table,
+                               const unsigned char* const* streams,
+                               const size_t* sizes, unsigned char* out,
+                               size_t size)
+    {
+        return decodeInterleavedTable(table, streams, sizes, out, size);
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    bool decodeInterleavedAvx512(const DecodeTable& table,
+                                 const unsigned char* const* streams,
+                                 const size_t* sizes, unsigned char* out,
+                                 size_t size)
+    {
+        return decodeInterleavedTable(table, streams, sizes, out, size);
+    }
+
+    unsigned int codewordLength(const DecodeTable& table,
+                                const unsigned char* data, size_t size,
+                                size_t bitPos)
+    {
+        unsigned char sym;
+        return decodeOne(table, data, size, bitPos, sym);
+    }
+
+    bool markCodewords(const DecodeTable& table, const unsigned char* data,
+                       size_t size, size_t& bitPos, size_t endBit,
+                       uint64_t* marks)
+    {
+        const DecodeEntry* entries = table.entries;
+        const unsigned int bits = table.bits;
+        const unsigned int shift = 64 - bits;
+        const unsigned int perRefill = 57 / bits;
+        const size_t start = bitPos;
+        size_t pos = bitPos;
+
+        // A refill's codewords all start within 57 bits of where it does
+        size_t fastEnd = 0;
+        if (size >= 8 && endBit >= 57)
+        {
+            fastEnd = (size - 8) * 8 < endBit - 57 ? (size - 8) * 8
+                                                   : endBit - 57;
+        }
+
+        while (pos < fastEnd)
+        {
+            uint64_t acc = loadBits(data, pos);
+            unsigned int k = 0;
+            for (; k < perRefill; k++)
+            {
+                DecodeEntry e = entries[acc >> shift];
+                if (e.len == 0)
+                {
+                    break;
+                }
+                setMark(marks, pos - start);
+                acc <<= e.len;
+                pos += e.len;
+            }
+
+            if (k < perRefill)
+            {
+                if (pos >= fastEnd)
+                {
+                    break;
+                }
+                unsigned int len;
+                if (decodeLong(table.code, loadBits(data, pos), bits + 1, len)
+                    < 0)
+                {
+                    bitPos = pos;
+                    return false;
+                }
+                setMark(marks, pos - start);
+                pos += len;
+            }
+        }
+
+        while (pos < endBit)
+        {
+            unsigned int len = codewordLength(table, data, size, pos);
+            if (len == 0)
+            {
+                bitPos = pos;
+                return false;
+            }
+            setMark(marks, pos - start);
+            pos += len;
+        }
+
+        bitPos = pos;
+        return true;
+    }
+
+    size_t decodeSymbols(const DecodeTable& table, const unsigned char* data,
+                         size_t size, size_t& bitPos, size_t endBit,
+                         unsigned char* out, size_t maxOut)
+    {
+        return kernels().decodeSymbols(table, data, size, bitPos, endBit, out,
+                                       maxOut);
+    }
+
+    size_t decodeMultiSymbols(const MultiDecodeTable& table,
+                              const unsigned char* data, size_t size,
+                              size_t& bitPos, size_t endBit,
+                              unsigned char* out, size_t maxOut)
+    {
+        return kernels().decodeMultiSymbols(table, data, size, bitPos, endBit,
+                                            out, maxOut);
+    }
+
+    bool decodeInterleaved(const DecodeTable& table,
+                           const unsigned char* const* streams,
+                           const size_t* sizes, unsigned char* out,
+                           size_t size)
+    {
+        return kernels().decodeInterleaved(table, streams, sizes, out, size);
+    }
+}
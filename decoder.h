@@ -0,0 +1,195 @@
+/* 
+ * File:   decoder.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Table-driven decoding of canonical Huffman codes.
+ */
+
+#ifndef DECODER_H
+#define	DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "codebook.h"
+
+namespace huffman
+{
+    // the widest first level of a DecodeTable; its 2^11 entries take 4 KiB
+    const unsigned int decodeTableBits = 11;
+
+    struct DecodeEntry
+    {
+        unsigned char sym;
+        unsigned char len; // the number of bits the codeword takes, or 0
+    };
+
+    /*
+    A two-level decoding table. The first level maps every possible value
+    of the next `bits` bits of input to the codeword they start with, so a
+    short codeword is decoded with one peek, one lookup and one consume.
+    Patterns that start a longer codeword have an entry of length 0, and
+    the codeword is found in the second level: code's first-code and limit
+    arrays, walked from length bits + 1. Memory stays bounded however long
+    the codewords get. Only the first 2^bits entries are used.
+    */
+    struct DecodeTable
+    {
+        unsigned int bits;
+        DecodeEntry entries[1 << decodeTableBits];
+        CanonicalCode code;
+    };
+
+    // the width of a MultiDecodeTable, whose 12 KiB of entries stay in L1
+    const unsigned int multiTableBits = 11;
+
+    // the most symbols a MultiEntry holds
+    const unsigned int maxMultiSymbols = 4;
+
+    struct MultiEntry
+    {
+        unsigned char syms[maxMultiSymbols];
+        unsigned char count; // 0 if the next codeword is longer than the table
+        unsigned char len;   // the number of bits the codewords take together
+    };
+
+    /*
+    Like a DecodeTable, but each entry holds every whole codeword (up to
+    maxMultiSymbols of them) in its multiTableBits bit pattern, so short
+    codes decode several symbols per lookup. Codewords longer than the table
+    are decoded from code instead.
+    */
+    struct MultiDecodeTable
+    {
+        MultiEntry entries[1 << multiTableBits];
+        CanonicalCode code;
+    };
+
+    // Builds table for code. Returns false if code has no codewords.
+    bool buildDecodeTable(const CanonicalCode& code, DecodeTable& table);
+
+    // Builds table for code, which may have codewords of any length
+    void buildMultiDecodeTable(const CanonicalCode& code,
+                               MultiDecodeTable& table);
+
+    // Returns true if code's codewords are short enough on average that a
+    // MultiDecodeTable decodes faster than a DecodeTable
+    bool preferMultiDecode(const CanonicalCode& code);
+
+    // The ways a single stream of codewords can be decoded
+    enum DecodeMethod
+    {
+        methodLookup, // a DecodeTable
+        methodMulti,  // a MultiDecodeTable
+        methodFsm,    // an FsmDecodeTable (fsmDecoder.h)
+        numDecodeMethods
+    };
+
+    // Returns the method to decode code's codewords with. It's the one the
+    // environment variable HUFFMAN_DECODER names ("lookup", "multi" or
+    // "fsm"), if any; otherwise methodMulti if preferMultiDecode(code), and
+    // methodLookup if not.
+    DecodeMethod decodeMethod(const CanonicalCode& code);
+
+    // the number of streams an interleaved block's symbols are dealt into
+    const unsigned int numStreams = 4;
+
+    // Decodes size symbols dealt round-robin into numStreams streams, so
+    // that symbol i is in stream i % numStreams. Stream s is the sizes[s]
+    // bytes at streams[s], zero-padded to a whole byte. Returns false if a
+    // stream holds an invalid codeword or runs out of codewords.
+    bool decodeInterleaved(const DecodeTable& table,
+                           const unsigned char* const* streams,
+                           const size_t* sizes, unsigned char* out,
+                           size_t size);
+
+    // Returns the length of the codeword at bit bitPos of the size bytes at
+    // data, or 0 if no codeword starts there
+    unsigned int codewordLength(const DecodeTable& table,
+                                const unsigned char* data, size_t size,
+                                size_t bitPos);
+
+    // Walks the codewords from bit bitPos of the size bytes at data, like
+    // decodeSymbols without storing the symbols, until bitPos reaches
+    // endBit. For every codeword starting p bits past the first, sets bit p
+    // of marks, which must have room for endBit - bitPos bits.
+    // Returns false if it meets an invalid codeword, leaving bitPos at it.
+    bool markCodewords(const DecodeTable& table, const unsigned char* data,
+                       size_t size, size_t& bitPos, size_t endBit,
+                       uint64_t* marks);
+
+    // Decodes symbols with table from the size bytes at data, starting at
+    // bit bitPos, until maxOut symbols have been written to out or bitPos
+    // reaches endBit. bitPos is advanced past the decoded codewords; if it
+    // ends past endBit, the input was corrupt.
+    // Returns the number of symbols written to out; if it's short of maxOut
+    // while bitPos is below endBit, the input held an invalid codeword.
+    size_t decodeSymbols(const DecodeTable& table, const unsigned char* data,
+                         size_t size, size_t& bitPos, size_t endBit,
+                         unsigned char* out, size_t maxOut);
+
+    // Decodes like decodeSymbols, with a MultiDecodeTable. Returns the
+    // number of symbols written to out; if it's short of maxOut while bitPos
+    // is below endBit, the input held an invalid codeword.
+    size_t decodeMultiSymbols(const MultiDecodeTable& table,
+                              const unsigned char* data, size_t size,
+                              size_t& bitPos, size_t endBit,
+                              unsigned char* out, size_t maxOut);
+
+    // The variants behind decodeSymbols, decodeMultiSymbols and
+    // decodeInterleaved, one per KernelLevel (dispatch.h). They're the same
+    // portable code compiled for each instruction set.
+    size_t decodeSymbolsScalar(const DecodeTable& table,
+                               const unsigned char* data, size_t size,
+                               size_t& bitPos, size_t endBit,
+                               unsigned char* out, size_t maxOut);
+    size_t decodeSymbolsSse42(const DecodeTable& table,
+                              const unsigned char* data, size_t size,
+                              size_t& bitPos, size_t endBit,
+                              unsigned char* out, size_t maxOut);
+    size_t decodeSymbolsAvx2(const DecodeTable& table,
+                             const unsigned char* data, size_t size,
+                             size_t& bitPos, size_t endBit,
+                             unsigned char* out, size_t maxOut);
+    size_t decodeSymbolsAvx512(const DecodeTable& table,
+                               const unsigned char* data, size_t size,
+                               size_t& bitPos, size_t endBit,
+                               unsigned char* out, size_t maxOut);
+
+    size_t decodeMultiSymbolsScalar(const MultiDecodeTable& table,
+                                    const unsigned char* data, size_t size,
+                                    size_t& bitPos, size_t endBit,
+                                    unsigned char* out, size_t maxOut);
+    size_t decodeMultiSymbolsSse42(const MultiDecodeTable& table,
+                                   const unsigned char* data, size_t size,
+                                   size_t& bitPos, size_t endBit,
+                                   unsigned char* out, size_t maxOut);
+    size_t decodeMultiSymbolsAvx2(const MultiDecodeTable& table,
+                                  const unsigned char* data, size_t size,
+                                  size_t& bitPos, size_t endBit,
+                                  unsigned char* out, size_t maxOut);
+    size_t decodeMultiSymbolsAvx512(const MultiDecodeTable& table,
+                                    const unsigned char* data, size_t size,
+                                    size_t& bitPos, size_t endBit,
+                                    unsigned char* out, size_t maxOut);
+
+    bool decodeInterleavedScalar(const DecodeTable& table,
+                                 const unsigned char* const* streams,
+                                 const size_t* sizes, unsigned char* out,
+                                 size_t size);
+    bool decodeInterleavedSse42(const DecodeTable& table,
+                                const unsigned char* const* streams,
+                                const size_t* sizes, unsigned char* out,
+                                size_t size);
+    bool decodeInterleavedAvx2(const DecodeTable& table,
+                               const unsigned char* const* streams,
+                               const size_t* sizes, unsigned char* out,
+                               size_t size);
+    bool decodeInterleavedAvx512(const DecodeTable& table,
+                                 const unsigned char* const* streams,
+                                 const size_t* sizes, unsigned char* out,
+                                 size_t size);
+}
+
+#endif	/* DECODER_H */
+
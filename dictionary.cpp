@@ -0,0 +1,601 @@
+/* 
+ * File:   dictionary.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "dictionary.h"
+#include "bitPack.h"
+#include "checksum.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace huffman
+{
+    namespace
+    {
+        // the total trainDictionary scales counts to; with every count at
+        // least 1, no codeword of a code on this many symbols is longer than
+        // maxDictionaryBits, as a codeword of d bits takes F(d+2) of them
+        const uint64_t trainTotal = 1 << 16;
+
+        // the bytes a dictionary block's payload takes before its codewords
+        const size_t dictionaryIdSize = 4;
+
+        // the number of symbols encodeObject packs at a time
+        const size_t packChunk = 512;
+
+        // Builds table from counts scaled down to about trainTotal, each
+        // byte counted at least once if everyByte is true, or each byte that
+        // occurs if not. Should rounding leave a codeword longer than
+        // maxDictionaryBits, the counts are flattened until none is.
+        void trainCode(const uint64_t* counts, bool everyByte,
+                       CodeTable& table)
+        {
+            uint64_t total = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                total += counts[c];
+            }
+
+            // leave room for the bytes counted up to 1
+            double scale = total > 0
+                           ? (double)(trainTotal - numSymbols) / total : 0;
+            uint64_t scaled[numSymbols];
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                scaled[c] = (uint64_t)(counts[c] * scale);
+                if (scaled[c] == 0 && (everyByte || counts[c] > 0))
+                {
+                    scaled[c] = 1;
+                }
+            }
+
+            buildCodeTable(scaled, table);
+            while (*std::max_element(table.lens, table.lens + numSymbols)
+                   > maxDictionaryBits)
+            {
+                for (unsigned int c = 0; c < numSymbols; c++)
+                {
+                    scaled[c] = scaled[c] > 0 ? scaled[c] / 2 + 1 : 0;
+                }
+                buildCodeTable(scaled, table);
+            }
+        }
+
+        // Returns the bits table codes the bytes counted in counts in
+        uint64_t codedBits(const CodeTable& table, const Histogram& counts)
+        {
+            uint64_t bits = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                bits += counts[c] * table.lens[c];
+            }
+            return bits;
+        }
+
+        // Returns true if table has a codeword for every byte counted in
+        // counts
+        bool covers(const CodeTable& table, const Histogram& counts)
+        {
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                if (counts[c] > 0 && table.lens[c] == 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        uint64_t codedBits(const Dictionary& dict, const Histogram& counts)
+        {
+            return codedBits(dict.table, counts);
+        }
+
+        // Returns the bits the bytes counted in counts take at their
+        // entropy, the fewest any code gives them
+        double entropyBits(const Histogram& counts)
+        {
+            uint64_t total = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                total += counts[c];
+            }
+            double bits = 0;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                if (counts[c] > 0)
+                {
+                    bits += counts[c] * std::log2((double)total / counts[c]);
+                }
+            }
+            return bits;
+        }
+
+        // Trains dicts[g] from the samples in group g, for every g
+        void retrain(const std::vector<Histogram>& samples,
+                     const std::vector<unsigned int>& group,
+                     std::vector<Dictionary>& dicts)
+        {
+            std::vector<Histogram> sums(dicts.size(), Histogram());
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                for (unsigned int c = 0; c < numSymbols; c++)
+                {
+                    sums[group[i]][c] += samples[i][c];
+                }
+            }
+            for (size_t g = 0; g < dicts.size(); g++)
+            {
+                trainDictionary(sums[g].data(), dicts[g]);
+            }
+        }
+
+        // Moves every sample to the group whose dictionary codes it in the
+        // fewest bits, setting cost to those bits. Returns the number of
+        // samples that moved.
+        size_t reassign(const std::vector<Histogram>& samples,
+                        const std::vector<Dictionary>& dicts,
+                        std::vector<unsigned int>& group,
+                        std::vector<uint64_t>& cost, unsigned int threads)
+        {
+            std::vector<unsigned int> best(samples.size());
+            parallelFor(samples.size(), [&](size_t i)
+            {
+                best[i] = 0;
+                cost[i] = codedBits(dicts[0], samples[i]);
+                for (unsigned int g = 1; g < dicts.size(); g++)
+                {
+                    uint64_t bits = codedBits(dicts[g], samples[i]);
+                    if (bits < cost[i])
+                    {
+                        best[i] = g;
+                        cost[i] = bits;
+                    }
+                }
+            }, threads);
+
+            size_t moved = 0;
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                moved += best[i] != group[i];
+                group[i] = best[i];
+            }
+            return moved;
+        }
+    }
+
+    void trainDictionary(const uint64_t* counts, Dictionary& dict)
+    {
+        CodeTable table;
+        trainCode(counts, true, table);
+        unsigned char lengths[numSymbols];
+        for (unsigned int c = 0; c < numSymbols; c++)
+        {
+            lengths[c] = table.lens[c];
+        }
+        if (!buildDictionary(lengths, dict))
+        {
+            // trainCode keeps the lengths in range, but dict is never left
+            // half built: a flat code of every byte always builds
+            memset(lengths, 8, sizeof(lengths));
+            buildDictionary(lengths, dict);
+        }
+    }
+
+    void trainDictionaries(const std::vector<Histogram>& samples,
+                           unsigned int numDicts,
+                           std::vector<TrainedDictionary>& trained,
+                           unsigned int threads)
+    {
+        trained.clear();
+        if (samples.empty() || numDicts == 0)
+        {
+            return;
+        }
+
+        std::vector<unsigned int> group(samples.size(), 0);
+        std::vector<uint64_t> cost(samples.size());
+        std::vector<Dictionary> dicts(1);
+        retrain(samples, group, dicts);
+        reassign(samples, dicts, group, cost, threads);
+
+        std::vector<double> entropy(samples.size());
+        parallelFor(samples.size(), [&](size_t i)
+        {
+            entropy[i] = entropyBits(samples[i]);
+        }, threads);
+
+        while (dicts.size() < numDicts)
+        {
+            // seed a new group with the sample whose dictionary wastes the
+            // most bits on it
+            size_t worst = 0;
+            double worstExcess = 0;
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                double excess = cost[i] - entropy[i];
+                if (excess > worstExcess)
+                {
+                    worst = i;
+                    worstExcess = excess;
+                }
+            }
+            if (worstExcess < 1)
+            {
+                break;
+            }
+            group[worst] = dicts.size();
+            dicts.emplace_back();
+            retrain(samples, group, dicts);
+
+            for (unsigned int pass = 0; pass < maxTrainPasses; pass++)
+            {
+                if (reassign(samples, dicts, group, cost, threads) == 0)
+                {
+                    break;
+                }
+                retrain(samples, group, dicts);
+            }
+            reassign(samples, dicts, group, cost, threads);
+        }
+
+        // groups left empty are dropped
+        trained.resize(dicts.size());
+        for (size_t g = 0; g < dicts.size(); g++)
+        {
+            trained[g].dict = dicts[g];
+            trained[g].numSamples = 0;
+            trained[g].numBytes = 0;
+            trained[g].bitsPerByte = 0;
+        }
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            TrainedDictionary& t = trained[group[i]];
+            t.numSamples++;
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                t.numBytes += samples[i][c];
+            }
+            t.bitsPerByte += cost[i];
+        }
+        for (TrainedDictionary& t : trained)
+        {
+            t.bitsPerByte = t.numBytes > 0 ? t.bitsPerByte / t.numBytes : 0;
+        }
+        trained.erase(std::remove_if(trained.begin(), trained.end(),
+                                     [](const TrainedDictionary& t)
+                                     { return t.numSamples == 0; }),
+                      trained.end());
+        std::stable_sort(trained.begin(), trained.end(),
+                         [](const TrainedDictionary& a,
+                            const TrainedDictionary& b)
+                         { return a.numBytes > b.numBytes; });
+    }
+
+    std::shared_ptr<const SharedCodes> chooseSharedCodes(
+        const std::vector<Histogram>& blocks, uint64_t sampleEvery,
+        unsigned int threads)
+    {
+        std::vector<TrainedDictionary> trained;
+        trainDictionaries(blocks, maxSharedCodes, trained, threads);
+        if (trained.empty())
+        {
+            return nullptr;
+        }
+
+        // the dictionaries code every byte, which costs a bit here and there
+        // that a block with few distinct bytes would rather keep, so each
+        // group's code is built again from the bytes its blocks have
+        std::vector<unsigned int> group(blocks.size(), 0);
+        parallelFor(blocks.size(), [&](size_t i)
+        {
+            uint64_t best = codedBits(trained[0].dict, blocks[i]);
+            for (unsigned int g = 1; g < trained.size(); g++)
+            {
+                uint64_t bits = codedBits(trained[g].dict, blocks[i]);
+                if (bits < best)
+                {
+                    group[i] = g;
+                    best = bits;
+                }
+            }
+        }, threads);
+        std::vector<Histogram> sums(trained.size(), Histogram());
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            for (unsigned int c = 0; c < numSymbols; c++)
+            {
+                sums[group[i]][c] += blocks[i][c];
+            }
+        }
+        std::vector<CodeTable> codes(trained.size());
+        for (size_t g = 0; g < trained.size(); g++)
+        {
+            trainCode(sums[g].data(), false, codes[g]);
+        }
+
+        // what each block saves by selecting the best shared code rather
+        // than giving its own codebook or, as encodeBlock would, repeating
+        // the last block's that gave one
+        std::vector<CodeTable> own(blocks.size());
+        parallelFor(blocks.size(), [&](size_t i)
+        {
+            buildCodeTable(blocks[i].data(), own[i]);
+        }, threads);
+        std::vector<uint64_t> saving(blocks.size(), 0);
+        std::vector<unsigned int> choice(blocks.size(), 0);
+        const CodeTable* last = nullptr;
+        unsigned int sinceCode = 0;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            uint64_t plainBytes = codebookSize(own[i])
+                                  + (codedBits(own[i], blocks[i]) + 7) / 8;
+            bool repeat = false;
+            if (last && sinceCode < maxRepeatRun && covers(*last, blocks[i]))
+            {
+                uint64_t bytes = 1 + (codedBits(*last, blocks[i]) + 7) / 8;
+                repeat = bytes <= plainBytes;
+                plainBytes = repeat ? bytes : plainBytes;
+            }
+            for (unsigned int g = 0; g < codes.size(); g++)
+            {
+                uint64_t bytes = 2 + (codedBits(codes[g], blocks[i]) + 7) / 8;
+                if (covers(codes[g], blocks[i]) && bytes < plainBytes
+                    && plainBytes - bytes > saving[i])
+                {
+                    saving[i] = plainBytes - bytes;
+                    choice[i] = g;
+                }
+            }
+            if (saving[i] == 0 && !repeat)
+            {
+                last = &own[i];
+                sinceCode = 0;
+            }
+            else
+            {
+                sinceCode++;
+            }
+        }
+
+        bool chosen[maxSharedCodes] = {false};
+        uint64_t total = 0;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            chosen[choice[i]] = chosen[choice[i]] || saving[i] > 0;
+            total += saving[i];
+        }
+        unsigned char lengths[maxSharedCodes][numSymbols];
+        unsigned int count = 0;
+        uint64_t cost = blockHeaderSize + 1;
+        for (unsigned int g = 0; g < codes.size(); g++)
+        {
+            if (chosen[g])
+            {
+                for (unsigned int c = 0; c < numSymbols; c++)
+                {
+                    lengths[count][c] = codes[g].lens[c];
+                }
+                count++;
+                cost += codebookSize(codes[g]);
+            }
+        }
+
+        std::shared_ptr<SharedCodes> shared = std::make_shared<SharedCodes>();
+        if (count == 0 || total * sampleEvery <= cost
+            || !buildSharedCodes(lengths, count, *shared))
+        {
+            return nullptr;
+        }
+        return shared;
+    }
+
+    bool buildDictionary(const unsigned char* lengths, Dictionary& dict)
+    {
+        for (unsigned int c = 0; c < numSymbols; c++)
+        {
+            if (lengths[c] == 0 || lengths[c] > maxDictionaryBits)
+            {
+                return false;
+            }
+        }
+        CanonicalCode code;
+        if (!buildCanonicalCode(lengths, numSymbols, code))
+        {
+            return false;
+        }
+
+        memcpy(dict.lengths, lengths, numSymbols);
+        dict.id = crc32c(lengths, numSymbols);
+        buildCodeTable(code, dict.table);
+        buildDecodeTable(code, dict.decodeTable);
+        return true;
+    }
+
+    void putDictionary(const Dictionary& dict, unsigned char* out)
+    {
+        memcpy(out, dictionaryMagic, sizeof(dictionaryMagic));
+        putLE32(out + 4, dict.id);
+        memcpy(out + 8, dict.lengths, numSymbols);
+    }
+
+    bool readDictionary(const unsigned char* data, size_t size,
+                        Dictionary& dict)
+    {
+        return size == dictionaryFileSize
+               && memcmp(data, dictionaryMagic, sizeof(dictionaryMagic)) == 0
+               && buildDictionary(data + 8, dict)
+               && dict.id == getLE32(data + 4);
+    }
+
+    char saveDictionary(const Dictionary& dict, const char* path)
+    {
+        unsigned char data[dictionaryFileSize];
+        putDictionary(dict, data);
+        std::ofstream file(path, std::ios::out | std::ios::binary
+                                 | std::ios::trunc);
+        file.write((const char*)data, sizeof(data));
+        file.close();
+        return file.good() ? 0 : 2;
+    }
+
+    std::shared_ptr<const Dictionary> DictionaryCache::add(
+        std::shared_ptr<const Dictionary> dict)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return byId.emplace(dict->id, dict).first->second;
+    }
+
+    std::shared_ptr<const Dictionary> DictionaryCache::get(uint32_t id) const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = byId.find(id);
+        return found != byId.end() ? found->second : nullptr;
+    }
+
+    std::shared_ptr<const Dictionary> DictionaryCache::load(
+        const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = byPath.find(path);
+            if (found != byPath.end())
+            {
+                return found->second;
+            }
+        }
+
+        // read without the lock, so other threads aren't held up; if two
+        // load the same file, the first to finish wins
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        std::vector<unsigned char> data(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+        std::shared_ptr<Dictionary> dict = std::make_shared<Dictionary>();
+        if (file.bad() || !readDictionary(data.data(), data.size(), *dict))
+        {
+            return nullptr;
+        }
+
+        std::shared_ptr<const Dictionary> cached = add(dict);
+        std::lock_guard<std::mutex> guard(lock);
+        return byPath.emplace(path, cached).first->second;
+    }
+
+    size_t objectBound(size_t size)
+    {
+        return blockBound(size);
+    }
+
+    char encodeObject(const Dictionary& dict, const unsigned char* in,
+                      size_t inSize, unsigned char* out, size_t outCapacity,
+                      size_t& written)
+    {
+        written = 0;
+
+        // a block can't say it decodes to more
+        if (inSize > maxBlockSize)
+        {
+            return 1;
+        }
+
+        // objects the dictionary wouldn't shrink become ordinary blocks
+        uint64_t bits = 0;
+        for (size_t i = 0; i < inSize; i++)
+        {
+            bits += dict.table.lens[in[i]];
+        }
+        size_t payloadSize = dictionaryIdSize + (bits + 7) / 8;
+        if (payloadSize >= inSize)
+        {
+            written = encodeBlock(in, inSize, true, out, outCapacity);
+            return written > 0 ? 0 : 3;
+        }
+
+        if (outCapacity < blockHeaderSize + payloadSize)
+        {
+            return 3;
+        }
+        out[0] = blockDictionary | lastBlockFlag;
+        putLE32(out + 1, inSize);
+        putLE32(out + 5, payloadSize);
+        putLE32(out + blockHeaderSize, dict.id);
+
+        // packCodes needs more room than the codewords take, so they're
+        // packed a chunk at a time through scratch space
+        unsigned char* codewords = out + blockHeaderSize + dictionaryIdSize;
+        unsigned char scratch[packChunk * maxCodeBits / 8 + packSlack];
+        PackState state = {0, 0};
+        for (size_t i = 0; i < inSize; i += packChunk)
+        {
+            size_t n = inSize - i < packChunk ? inSize - i : packChunk;
+            n = packCodes(dict.table, in + i, n, state, scratch);
+            memcpy(codewords, scratch, n);
+            codewords += n;
+        }
+        flushBits(state, codewords);
+        written = blockHeaderSize + payloadSize;
+        return 0;
+    }
+
+    char decodeObject(const DictionaryCache& dictionaries,
+                      const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity,
+                      size_t& written)
+    {
+        written = 0;
+        BlockHeader header;
+        if (!readBlockHeader(in, inSize, header) || !header.last
+            || header.payloadSize != inSize - blockHeaderSize)
+        {
+            return 4; // in is corrupt
+        }
+        if (header.rawSize > outCapacity)
+        {
+            return 3; // out is too small
+        }
+
+        const unsigned char* body = in + blockHeaderSize;
+        if (header.type != blockDictionary)
+        {
+            if (!decodeBlock(header, body, out))
+            {
+                return 4;
+            }
+            written = header.rawSize;
+            return 0;
+        }
+
+        // the codewords follow the id alone
+        if (header.payloadSize < dictionaryIdSize || header.checksummed
+            || header.compact)
+        {
+            return 4;
+        }
+        std::shared_ptr<const Dictionary> dict =
+            dictionaries.get(getLE32(body));
+        if (!dict)
+        {
+            return 7; // the dictionary isn't loaded
+        }
+
+        size_t bitPos = 0;
+        size_t endBit = (header.payloadSize - dictionaryIdSize) * 8;
+        size_t n = decodeSymbols(dict->decodeTable, body + dictionaryIdSize,
+                                 header.payloadSize - dictionaryIdSize,
+                                 bitPos, endBit, out, header.rawSize);
+        if (n != header.rawSize || bitPos > endBit)
+        {
+            return 4;
+        }
+        written = n;
+        return 0;
+    }
+}
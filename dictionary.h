@@ -0,0 +1,189 @@
+/* 
+ * File:   dictionary.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Pretrained codebooks shared by many small objects, so that each object
+ * needs neither a histogram nor a codebook of its own, and the clustering
+ * that trains them, which also finds the codes the blocks of a long stream
+ * can share.
+ *
+ * A dictionary is a canonical codebook trained once from a sample corpus.
+ * Its id is the CRC-32C of its codeword lengths, so the same codebook always
+ * gets the same id and a damaged one is caught on loading. A .hufdict file
+ * holding one is
+ *     4 bytes   - dictionaryMagic
+ *     4 bytes   - the dictionary's id (little-endian)
+ *     256 bytes - the codeword length of every symbol, in symbol order
+ *
+ * An object encoded against a dictionary is a single block (block.h) of
+ * type blockDictionary, whose payload is the 4-byte id of the dictionary
+ * (little-endian) followed by the codewords, packed like a Huffman block's;
+ * it has neither a checksum nor a compact codebook, so neither flag is set.
+ * An object the dictionary would code in more bytes than it has is encoded
+ * as an ordinary block instead.
+ */
+
+#ifndef DICTIONARY_H
+#define	DICTIONARY_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "block.h"
+#include "codebook.h"
+#include "decoder.h"
+
+namespace huffman
+{
+    const unsigned char dictionaryMagic[4] = {'H', 'U', 'F', 'D'};
+
+    const size_t dictionaryFileSize = 8 + numSymbols;
+
+    // The code, and the tables to encode and decode with it, built once
+    struct Dictionary
+    {
+        uint32_t id;
+        unsigned char lengths[numSymbols];
+        CodeTable table;
+        DecodeTable decodeTable;
+    };
+
+    // Builds dict from the byte counts of a sample corpus. The counts are
+    // scaled down, with every byte counted at least once, so any object can
+    // be coded, and flattened further if need be so no codeword is longer
+    // than maxDictionaryBits. dict is always a valid dictionary.
+    void trainDictionary(const uint64_t* counts, Dictionary& dict);
+
+    // the longest codeword trainDictionary gives
+    const unsigned int maxDictionaryBits = 24;
+
+    // the byte counts of one sample
+    typedef std::array<uint64_t, numSymbols> Histogram;
+
+    // A dictionary trained for a group of samples, and how well it codes them
+    struct TrainedDictionary
+    {
+        Dictionary dict;
+        size_t numSamples;
+        uint64_t numBytes;
+        double bitsPerByte; // the bits the code gives each of their bytes
+    };
+
+    // the most passes trainDictionaries makes over the samples
+    const unsigned int maxTrainPasses = 16;
+
+    // Clusters samples, the histograms of a sample corpus, into up to
+    // numDicts groups of similar statistics, and trains a dictionary for
+    // each, added to trained from the group with the most bytes down. A
+    // sample belongs to the group whose dictionary codes it in the fewest
+    // bits: starting from one group, a new one is seeded with the sample the
+    // existing dictionaries code worst, then the samples are reassigned and
+    // the dictionaries retrained until no sample moves. Each pass costs a
+    // dictionary per sample; it's spread over up to threads threads (one per
+    // core if 0).
+    void trainDictionaries(const std::vector<Histogram>& samples,
+                           unsigned int numDicts,
+                           std::vector<TrainedDictionary>& trained,
+                           unsigned int threads = 0);
+
+    // the most histograms chooseSharedCodes is worth giving; the blocks of
+    // a longer stream are better sampled
+    const size_t maxSharedSamples = 4096;
+
+    // Codes are only chosen for streams of at least minSharedBlocks blocks
+    // of at most maxSharedBlockSize bytes. Longer or fewer blocks spend too
+    // little on their codebooks for sharing to pay for counting the stream
+    // before encoding it.
+    const size_t maxSharedBlockSize = 1 << 15;
+    const size_t minSharedBlocks = 16;
+
+    // Chooses codes for the blocks of a stream to share (block.h), given
+    // the histograms of its blocks in order, by clustering them as
+    // trainDictionaries does into up to maxSharedCodes groups, each coded
+    // for the bytes its blocks have. Only the codes some block would select
+    // over its own codebook or the last one repeated are kept. If blocks
+    // only samples the stream, one block in every sampleEvery, each saves
+    // for that many. Returns nothing if selecting the codes saves less than
+    // the shared codes block costs, as it does for streams whose blocks are
+    // alike.
+    std::shared_ptr<const SharedCodes> chooseSharedCodes(
+        const std::vector<Histogram>& blocks, uint64_t sampleEvery = 1,
+        unsigned int threads = 0);
+
+    // Builds dict from the codeword lengths of every symbol. Returns false
+    // if they don't describe a prefix code with a codeword for every symbol
+    // of at most maxDictionaryBits bits.
+    bool buildDictionary(const unsigned char* lengths, Dictionary& dict);
+
+    // Writes dict as a .hufdict file to out, which has room for
+    // dictionaryFileSize bytes
+    void putDictionary(const Dictionary& dict, unsigned char* out);
+
+    // Parses the .hufdict file in the size bytes at data into dict.
+    // Returns false if it's invalid or its id doesn't match its lengths.
+    bool readDictionary(const unsigned char* data, size_t size,
+                        Dictionary& dict);
+
+    // Writes dict to the .hufdict file at path.
+    // returns 0 if successful, 2 if path is invalid
+    char saveDictionary(const Dictionary& dict, const char* path);
+
+    /*
+    Dictionaries loaded once and shared read-only between threads. Every
+    member can be called from any thread; the dictionaries handed out are
+    never changed, so they can be used without holding any lock, and live
+    as long as anyone holds them.
+    */
+    class DictionaryCache {
+    public:
+        // Adds dict, unless one with its id is already cached. Returns the
+        // cached one.
+        std::shared_ptr<const Dictionary> add(
+            std::shared_ptr<const Dictionary> dict);
+
+        // Returns the dictionary with the given id, or nothing if none is
+        // cached
+        std::shared_ptr<const Dictionary> get(uint32_t id) const;
+
+        // Returns the dictionary in the .hufdict file at path, reading it
+        // only the first time. Returns nothing if it can't be read or is
+        // invalid.
+        std::shared_ptr<const Dictionary> load(const std::string& path);
+
+    private:
+        mutable std::mutex lock;
+        std::map<uint32_t, std::shared_ptr<const Dictionary>> byId;
+        std::map<std::string, std::shared_ptr<const Dictionary>> byPath;
+    };
+
+    // Returns the most bytes encodeObject can write for size input bytes
+    size_t objectBound(size_t size);
+
+    // encodes the inSize bytes at in (at most maxBlockSize) against dict
+    // into out, which has room for outCapacity bytes. written is set to the
+    // number of bytes written to out.
+    // returns 0 if successful, 1 if inSize is more than maxBlockSize, 3 if
+    // out is too small
+    char encodeObject(const Dictionary& dict, const unsigned char* in,
+                      size_t inSize, unsigned char* out, size_t outCapacity,
+                      size_t& written);
+
+    // decodes the object in the inSize bytes at in, produced by
+    // encodeObject, into out, which has room for outCapacity bytes, with
+    // the dictionary from dictionaries it names. written is set to the
+    // number of bytes written to out.
+    // returns 0 if successful, 3 if out is too small, 4 if in is corrupt, 7
+    // if its dictionary isn't in dictionaries
+    char decodeObject(const DictionaryCache& dictionaries,
+                      const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity,
+                      size_t& written);
+}
+
+#endif	/* DICTIONARY_H */
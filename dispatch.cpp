@@ -0,0 +1,104 @@
+/* 
+ * File:   dispatch.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "dispatch.h"
+#include "checksum.h"
+#include "histogram.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace huffman
+{
+    namespace
+    {
+        // the name of the environment variable that forces a kernel level
+        const char* const levelVariable = "HUFFMAN_KERNELS";
+
+        const Kernels allKernels[numKernelLevels] = {
+            { levelScalar, "scalar", countCharsScalar, packCodesScalar,
+              decodeSymbolsScalar, decodeMultiSymbolsScalar,
+              decodeInterleavedScalar,
+              countCharsCrcScalar, crc32cScalar },
+            { levelSse42, "sse4.2", countCharsSse42, packCodesSse42,
+              decodeSymbolsSse42, decodeMultiSymbolsSse42,
+              decodeInterleavedSse42,
+              countCharsCrcSse42, crc32cSse42 },
+            { levelAvx2, "avx2", countCharsAvx2, packCodesAvx2,
+              decodeSymbolsAvx2, decodeMultiSymbolsAvx2,
+              decodeInterleavedAvx2,
+              countCharsCrcAvx2, crc32cSse42 },
+            { levelAvx512, "avx512", countCharsAvx512, packCodesAvx512,
+              decodeSymbolsAvx512, decodeMultiSymbolsAvx512,
+              decodeInterleavedAvx512,
+              countCharsCrcAvx512, crc32cSse42 }
+        };
+
+        bool supported(KernelLevel level)
+        {
+            __builtin_cpu_init();
+            switch (level)
+            {
+                case levelScalar:
+                    return true;
+                case levelSse42:
+                    return __builtin_cpu_supports("sse4.2")
+                           && __builtin_cpu_supports("popcnt");
+                case levelAvx2:
+                    return __builtin_cpu_supports("avx2")
+                           && __builtin_cpu_supports("bmi2");
+                case levelAvx512:
+                    return __builtin_cpu_supports("avx512f")
+                           && __builtin_cpu_supports("avx512bw")
+                           && __builtin_cpu_supports("bmi2");
+                default:
+                    return false;
+            }
+        }
+
+        const Kernels* chooseKernels()
+        {
+            // honour a forced level if the CPU can run it
+            const char* forced = getenv(levelVariable);
+            if (forced)
+            {
+                for (int l = 0; l < numKernelLevels; l++)
+                {
+                    if (strcmp(forced, allKernels[l].name) == 0
+                        && supported((KernelLevel)l))
+                    {
+                        return &allKernels[l];
+                    }
+                }
+            }
+
+            // otherwise take the most capable one
+            for (int l = numKernelLevels - 1; l > levelScalar; l--)
+            {
+                if (supported((KernelLevel)l))
+                {
+                    return &allKernels[l];
+                }
+            }
+            return &allKernels[levelScalar];
+        }
+    }
+
+    const Kernels& kernels()
+    {
+        static const Kernels* chosen = chooseKernels();
+        return *chosen;
+    }
+
+    const Kernels* kernelsFor(KernelLevel level)
+    {
+        if (level < levelScalar || level >= numKernelLevels
+            || !supported(level))
+        {
+            return NULL;
+        }
+        return &allKernels[level];
+    }
+}
@@ -0,0 +1,73 @@
+/* 
+ * File:   dispatch.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Picks the variant of each hot kernel that best suits the CPU we run on.
+ */
+
+#ifndef DISPATCH_H
+#define	DISPATCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bitPack.h"
+#include "codebook.h"
+#include "decoder.h"
+
+namespace huffman
+{
+    // The instruction sets the kernels are built for, from least to most
+    // capable
+    enum KernelLevel
+    {
+        levelScalar,
+        levelSse42,
+        levelAvx2,   // AVX2 and BMI2
+        levelAvx512, // AVX-512 F and BW, plus BMI2
+        numKernelLevels
+    };
+
+    // One variant of every hot kernel
+    struct Kernels
+    {
+        KernelLevel level;
+        const char* name;
+
+        void (*countChars)(const unsigned char* data, size_t size,
+                           uint64_t* counts);
+        size_t (*packCodes)(const CodeTable& table, const unsigned char* in,
+                            size_t size, PackState& state, unsigned char* out);
+        size_t (*decodeSymbols)(const DecodeTable& table,
+                                const unsigned char* data, size_t size,
+                                size_t& bitPos, size_t endBit,
+                                unsigned char* out, size_t maxOut);
+        size_t (*decodeMultiSymbols)(const MultiDecodeTable& table,
+                                     const unsigned char* data, size_t size,
+                                     size_t& bitPos, size_t endBit,
+                                     unsigned char* out, size_t maxOut);
+        bool (*decodeInterleaved)(const DecodeTable& table,
+                                  const unsigned char* const* streams,
+                                  const size_t* sizes, unsigned char* out,
+                                  size_t size);
+        void (*countCharsCrc)(const unsigned char* data, size_t size,
+                              uint64_t* counts, uint32_t& crc);
+        uint32_t (*crc32c)(const unsigned char* data, size_t size,
+                           uint32_t crc);
+    };
+
+    // Returns the kernels used by the library. They're chosen on the first
+    // call: the most capable level this CPU supports, unless the environment
+    // variable HUFFMAN_KERNELS names another supported level ("scalar",
+    // "sse4.2", "avx2" or "avx512"). Only packCodes (with gathers from AVX2
+    // up) and the CRC-32C (with the crc32 instruction from SSE4.2 up) have
+    // code written for a level; the rest are the portable code compiled for
+    // it.
+    const Kernels& kernels();
+
+    // Returns the kernels for level, or NULL if this CPU can't run them
+    const Kernels* kernelsFor(KernelLevel level);
+}
+
+#endif	/* DISPATCH_H */
+
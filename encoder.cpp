@@ -0,0 +1,115 @@
+/* 
+ * File:   encoder.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "encoder.h"
+#include "blockSplit.h"
+
+#include <cstring>
+
+namespace huffman
+{
+    Encoder::Encoder(Sink sink, size_t blockSize, bool checksum)
+        : sink(sink),
+          blockSize(blockSize == 0 || blockSize > maxBlockSize
+                    ? maxBlockSize : blockSize),
+          checksum(checksum),
+          finished(false),
+          started(false)
+    {
+        pending.reserve(this->blockSize);
+        encoded.resize(blockBound(this->blockSize));
+    }
+
+    bool Encoder::push(const unsigned char* data, size_t size)
+    {
+        if (finished)
+        {
+            return false;
+        }
+
+        bool success = true;
+        while (size > 0 && success)
+        {
+            if (pending.empty() && size >= blockSize)
+            {
+                // A whole block is available; encode it without copying.
+                uint64_t counts[numSymbols];
+                size_t n = chooseBlockEnd(data, blockSize, counts);
+                success = emitBlock(data, n, false, counts);
+                data += n;
+                size -= n;
+            }
+            else
+            {
+                size_t n = blockSize - pending.size();
+                n = n < size ? n : size;
+                pending.insert(pending.end(), data, data + n);
+                data += n;
+                size -= n;
+
+                if (pending.size() == blockSize)
+                {
+                    uint64_t counts[numSymbols];
+                    n = chooseBlockEnd(pending.data(), pending.size(),
+                                       counts);
+                    success = emitBlock(pending.data(), n, false, counts);
+                    pending.erase(pending.begin(), pending.begin() + n);
+                }
+            }
+        }
+        return success;
+    }
+
+    bool Encoder::shareCodes(std::shared_ptr<const SharedCodes> shared)
+    {
+        if (started || !pending.empty())
+        {
+            return false;
+        }
+
+        // the codes take no more than their own codebooks
+        size_t bound = blockHeaderSize + 1 + maxSharedCodes * maxCodebookSize;
+        if (encoded.size() < bound)
+        {
+            encoded.resize(bound);
+        }
+        size_t n = encodeSharedCodes(shared, encoded.data(), encoded.size(),
+                                     context);
+        started = true;
+        return n > 0 && sink(encoded.data(), n);
+    }
+
+    bool Encoder::finish()
+    {
+        if (finished)
+        {
+            return false;
+        }
+
+        // The rest may still split in several; the last piece (maybe
+        // empty) ends the stream
+        finished = true;
+        bool success = true;
+        bool last = false;
+        while (success && !last)
+        {
+            uint64_t counts[numSymbols];
+            size_t n = chooseBlockEnd(pending.data(), pending.size(), counts);
+            last = n == pending.size();
+            success = emitBlock(pending.data(), n, last, counts);
+            pending.erase(pending.begin(), pending.begin() + n);
+        }
+        return success;
+    }
+
+    bool Encoder::emitBlock(const unsigned char* in, size_t size, bool last,
+                            const uint64_t* counts)
+    {
+        size_t n = encodeBlock(in, size, last, encoded.data(),
+                               encoded.size(), &context, checksum, counts);
+        started = true;
+        return sink(encoded.data(), n);
+    }
+}
@@ -0,0 +1,91 @@
+/* 
+ * File:   encoder.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Incremental encoder for streams of unknown length.
+ */
+
+#ifndef ENCODER_H
+#define	ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "block.h"
+
+namespace huffman
+{
+    /*
+    Encodes a stream that arrives in pieces. Input is buffered until a whole
+    block has arrived, then that block is encoded and handed to the sink, so
+    memory use is bounded by the block size no matter how long the stream is.
+    A block is cut short where its content changes (blockSplit.h), leaving
+    the rest for the next one. The output is a sequence of blocks as
+    described in block.h.
+    */
+    class Encoder {
+    public:
+        // Receives each piece of encoded output. Returns false to report a
+        // failure, which makes push or finish fail.
+        typedef std::function<bool(const unsigned char* data, size_t size)>
+            Sink;
+
+        // blockSize is capped at maxBlockSize. If checksum is true, every
+        // block has a checksum.
+        Encoder(Sink sink, size_t blockSize = defaultBlockSize,
+                bool checksum = false);
+
+        Encoder(const Encoder&) = delete;
+        Encoder& operator=(const Encoder&) = delete;
+
+        Encoder(Encoder&&) = delete;
+        Encoder& operator=(Encoder&&) = delete;
+
+        // Adds size bytes of data to the stream, emitting every block that
+        // fills up. Returns true if successful; fails if finish has already
+        // been called or the sink fails.
+        bool push(const unsigned char* data, size_t size);
+
+        // Emits a shared codes block giving shared, which the blocks after
+        // it select from when that's smaller than giving their own
+        // codebook (block.h). Only valid before anything is pushed.
+        // Returns true if successful.
+        bool shareCodes(std::shared_ptr<const SharedCodes> shared);
+
+        // Emits the remaining input as the last block of the stream. The
+        // encoder can't be pushed to afterwards. Returns true if successful.
+        bool finish();
+
+        bool isFinished() { return finished; }
+
+        // the most bytes of input a block takes
+        size_t getBlockSize() { return blockSize; }
+
+    private:
+        // Encodes size bytes of in, whose byte counts are counts, as one
+        // block and passes it to the sink. Returns the sink's result.
+        bool emitBlock(const unsigned char* in, size_t size, bool last,
+                       const uint64_t* counts);
+
+        Sink sink;
+        size_t blockSize;
+        bool checksum;
+        bool finished;
+        bool started; // a block has been emitted
+
+        // The codes later blocks can reuse
+        CodeContext context;
+
+        // Input that hasn't filled a whole block yet
+        std::vector<unsigned char> pending;
+
+        // Holds each encoded block until the sink takes it
+        std::vector<unsigned char> encoded;
+    };
+}
+
+#endif	/* ENCODER_H */
+
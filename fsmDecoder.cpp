@@ -0,0 +1,175 @@
+/* 
+ * File:   fsmDecoder.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "fsmDecoder.h"
+
+#include <cstring>
+
+namespace huffman
+{
+    namespace
+    {
+        // the start of every codeword
+        const unsigned char rootState = 0;
+
+        // Takes bit pos of data in state, storing the symbol of the
+        // codeword it completes, if any, at out + n
+        inline void stepBit(const FsmDecodeTable& table,
+                            const unsigned char* data, size_t pos,
+                            unsigned int& state, unsigned char* out,
+                            size_t& n)
+        {
+            unsigned int bit = data[pos >> 3] >> (7 - (pos & 7)) & 1;
+            const FsmEntry& e = table.steps[state][bit];
+            if (e.count > 0)
+            {
+                out[n++] = e.syms[0];
+            }
+            state = e.next;
+        }
+    }
+
+    bool buildFsmDecodeTable(const CanonicalCode& code, FsmDecodeTable& table)
+    {
+        if (code.numCodes == 0)
+        {
+            return false;
+        }
+
+        // Every transition starts out leading to the dead state
+        FsmEntry dead;
+        memset(&dead, 0, sizeof(dead));
+        dead.next = fsmDeadState;
+        for (unsigned int s = 0; s <= maxFsmStates; s++)
+        {
+            for (unsigned int v = 0; v < (1 << fsmStepBits); v++)
+            {
+                table.entries[s][v] = dead;
+            }
+            table.steps[s][0] = dead;
+            table.steps[s][1] = dead;
+            table.depth[s] = 0;
+        }
+
+        // Grow the tree one codeword at a time, numbering internal nodes as
+        // they're made; a codeword's last bit leads back to the root
+        unsigned int numStates = 1;
+        for (unsigned int len = 1; len <= code.maxBits; len++)
+        {
+            for (unsigned int i = 0; i < code.count[len]; i++)
+            {
+                uint32_t value = code.first[len] + i;
+                unsigned int state = rootState;
+                for (unsigned int b = len - 1; b > 0; b--)
+                {
+                    FsmEntry& step = table.steps[state][value >> b & 1];
+                    if (step.next == fsmDeadState)
+                    {
+                        if (numStates == maxFsmStates)
+                        {
+                            return false;
+                        }
+                        table.depth[numStates] = table.depth[state] + 1;
+                        step.next = numStates++;
+                    }
+                    state = step.next;
+                }
+
+                FsmEntry& step = table.steps[state][value & 1];
+                step.syms[0] = code.symbols[code.index[len] + i];
+                step.count = 1;
+                step.next = rootState;
+            }
+        }
+
+        // A step of fsmStepBits bits is that many single steps
+        for (unsigned int s = 0; s < numStates; s++)
+        {
+            for (unsigned int v = 0; v < (1 << fsmStepBits); v++)
+            {
+                FsmEntry& e = table.entries[s][v];
+                unsigned int state = s;
+                for (int b = fsmStepBits - 1;
+                     b >= 0 && state != fsmDeadState; b--)
+                {
+                    const FsmEntry& step = table.steps[state][v >> b & 1];
+                    if (step.count > 0)
+                    {
+                        e.syms[e.count++] = step.syms[0];
+                    }
+                    state = step.next;
+                }
+                e.next = state;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Single bits are taken up to the first whole byte. The steady state then
+    takes a byte per iteration as two nibble steps, while 8 more bits lie
+    below endBit and out has room for the 8 symbols they might hold. It
+    reaching the dead state rolls the byte back for the tail, which takes
+    single bits again, and goes past endBit only to finish a codeword. A
+    codeword's start is wherever the machine was at the root, which is the
+    current position less the depth of the current state.
+    */
+    size_t decodeFsmSymbols(const FsmDecodeTable& table,
+                            const unsigned char* data, size_t size,
+                            size_t& bitPos, size_t endBit,
+                            unsigned char* out, size_t maxOut)
+    {
+        const size_t limit = size * 8 < endBit ? size * 8 : endBit;
+        size_t pos = bitPos;
+        size_t n = 0;
+        unsigned int state = rootState;
+
+        while ((pos & 7) != 0 && pos < limit && n < maxOut)
+        {
+            unsigned int last = state;
+            stepBit(table, data, pos, state, out, n);
+            if (state == fsmDeadState)
+            {
+                bitPos = pos - table.depth[last];
+                return n;
+            }
+            pos++;
+        }
+
+        // only reached unaligned if there's nothing left for it
+        while (pos + 8 <= limit && n + 8 <= maxOut)
+        {
+            unsigned int byte = data[pos >> 3];
+            const FsmEntry& high = table.entries[state][byte >> 4];
+            memcpy(out + n, high.syms, fsmStepBits);
+            size_t m = n + high.count;
+            const FsmEntry& low = table.entries[high.next][byte & 15];
+            memcpy(out + m, low.syms, fsmStepBits);
+            if (low.next == fsmDeadState)
+            {
+                break;
+            }
+            n = m + low.count;
+            state = low.next;
+            pos += 8;
+        }
+
+        while (n < maxOut && (pos < endBit || state != rootState)
+               && pos < size * 8)
+        {
+            unsigned int last = state;
+            stepBit(table, data, pos, state, out, n);
+            if (state == fsmDeadState)
+            {
+                bitPos = pos - table.depth[last];
+                return n;
+            }
+            pos++;
+        }
+
+        bitPos = pos - table.depth[state];
+        return n;
+    }
+}
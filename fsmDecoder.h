@@ -0,0 +1,69 @@
+/* 
+ * File:   fsmDecoder.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Decoding of canonical Huffman codes by a finite-state machine that takes
+ * its input a nibble at a time.
+ */
+
+#ifndef FSMDECODER_H
+#define	FSMDECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "codebook.h"
+
+namespace huffman
+{
+    // the number of bits an FsmDecodeTable takes per step
+    const unsigned int fsmStepBits = 4;
+
+    // the most states an FsmDecodeTable has: one per internal node of a
+    // complete code on numSymbols symbols, so a state fits in a byte
+    const unsigned int maxFsmStates = numSymbols - 1;
+
+    // the state every transition of an invalid bit pattern leads to, and
+    // that never leaves
+    const unsigned char fsmDeadState = maxFsmStates;
+
+    struct FsmEntry
+    {
+        unsigned char syms[fsmStepBits]; // the codewords the step completes
+        unsigned char count;             // the number of them
+        unsigned char next;              // the state the step leads to
+    };
+
+    /*
+    The code's tree as a state machine. A state is an internal node of the
+    tree, the root (state 0) being the start of a codeword, and its depth
+    is the number of bits of the current codeword taken so far. Each state
+    has a transition for every fsmStepBits-bit value of the input, giving
+    the symbols of the codewords it completes and the state it leaves the
+    machine in, so the input is decoded without any bit cursor: each byte
+    takes two lookups, each depending only on the last. steps holds the
+    transitions for single bits, used up to the first whole byte and in the
+    tail.
+    */
+    struct FsmDecodeTable
+    {
+        FsmEntry entries[maxFsmStates + 1][1 << fsmStepBits];
+        FsmEntry steps[maxFsmStates + 1][2];
+        unsigned char depth[maxFsmStates + 1];
+    };
+
+    // Builds table for code. Returns false if code has no codewords, or
+    // is incomplete enough that its tree has more than maxFsmStates
+    // internal nodes.
+    bool buildFsmDecodeTable(const CanonicalCode& code, FsmDecodeTable& table);
+
+    // Decodes like decodeSymbols (decoder.h), with an FsmDecodeTable.
+    // Returns the number of symbols written to out; if it's short of maxOut
+    // while bitPos is below endBit, the input held an invalid codeword.
+    size_t decodeFsmSymbols(const FsmDecodeTable& table,
+                            const unsigned char* data, size_t size,
+                            size_t& bitPos, size_t endBit,
+                            unsigned char* out, size_t maxOut);
+}
+
+#endif	/* FSMDECODER_H */
@@ -0,0 +1,181 @@
+/* 
+ * File:   histogram.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "histogram.h"
+#include "checksum.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace huffman
+{
+    namespace
+    {
+        // the most bytes counted into the 32-bit tables before they're added
+        // to the caller's 64-bit counts
+        const size_t maxRun = (size_t)1 << 31;
+
+        /*
+        Counting into a single table stalls whenever neighbouring bytes are
+        equal, since each increment has to wait for the previous store to the
+        same counter. Spreading consecutive bytes over 4 tables breaks those
+        dependencies, and reading 8 bytes per load halves the load count.
+        Crc continues the uninverted CRC-32C crc over each word as it's
+        counted, or does nothing.
+        */
+        template <typename Crc>
+        __attribute__((always_inline))
+        inline void countRuns(const unsigned char* data, size_t size,
+                              uint64_t* counts, uint32_t& crc)
+        {
+            while (size > 0)
+            {
+                size_t run = size < maxRun ? size : maxRun;
+                uint32_t tables[4][256];
+                memset(tables, 0, sizeof(tables));
+
+                size_t i = 0;
+                for (; i + 8 <= run; i += 8)
+                {
+                    uint64_t word;
+                    memcpy(&word, data + i, sizeof(word));
+                    crc = Crc::word(crc, word);
+                    tables[0][word & 0xFF]++;
+                    tables[1][(word >> 8) & 0xFF]++;
+                    tables[2][(word >> 16) & 0xFF]++;
+                    tables[3][(word >> 24) & 0xFF]++;
+                    tables[0][(word >> 32) & 0xFF]++;
+                    tables[1][(word >> 40) & 0xFF]++;
+                    tables[2][(word >> 48) & 0xFF]++;
+                    tables[3][word >> 56]++;
+                }
+                for (; i < run; i++)
+                {
+                    crc = Crc::byte(crc, data[i]);
+                    tables[0][data[i]]++;
+                }
+
+                for (int c = 0; c < 256; c++)
+                {
+                    counts[c] += (uint64_t)tables[0][c] + tables[1][c]
+                                 + tables[2][c] + tables[3][c];
+                }
+
+                data += run;
+                size -= run;
+            }
+        }
+
+        struct NoCrc
+        {
+            __attribute__((always_inline))
+            static inline uint32_t word(uint32_t c, uint64_t)
+            {
+                return c;
+            }
+            __attribute__((always_inline))
+            static inline uint32_t byte(uint32_t c, unsigned char)
+            {
+                return c;
+            }
+        };
+
+        struct TableCrc
+        {
+            __attribute__((always_inline))
+            static inline uint32_t word(uint32_t c, uint64_t word)
+            {
+                return crc32cWord(c, word);
+            }
+            __attribute__((always_inline))
+            static inline uint32_t byte(uint32_t c, unsigned char byte)
+            {
+                return crc32cByte(c, byte);
+            }
+        };
+
+        // Not always_inline, which would be checked against countRuns
+        // before it's inlined into a function built for SSE4.2
+        struct InstructionCrc
+        {
+            __attribute__((target("sse4.2")))
+            static inline uint32_t word(uint32_t c, uint64_t word)
+            {
+                return _mm_crc32_u64(c, word);
+            }
+            __attribute__((target("sse4.2")))
+            static inline uint32_t byte(uint32_t c, unsigned char byte)
+            {
+                return _mm_crc32_u8(c, byte);
+            }
+        };
+    }
+
+    void countCharsScalar(const unsigned char* data, size_t size,
+                          uint64_t* counts)
+    {
+        uint32_t c = 0;
+        countRuns<NoCrc>(data, size, counts, c);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    void countCharsSse42(const unsigned char* data, size_t size,
+                         uint64_t* counts)
+    {
+        uint32_t c = 0;
+        countRuns<NoCrc>(data, size, counts, c);
+    }
+
+    __attribute__((target("avx2,bmi2")))
+    void countCharsAvx2(const unsigned char* data, size_t size,
+                        uint64_t* counts)
+    {
+        uint32_t c = 0;
+        countRuns<NoCrc>(data, size, counts, c);
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    void countCharsAvx512(const unsigned char* data, size_t size,
+                          uint64_t* counts)
+    {
+        uint32_t c = 0;
+        countRuns<NoCrc>(data, size, counts, c);
+    }
+
+    void countCharsCrcScalar(const unsigned char* data, size_t size,
+                             uint64_t* counts, uint32_t& crc)
+    {
+        uint32_t c = ~crc;
+        countRuns<TableCrc>(data, size, counts, c);
+        crc = ~c;
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    void countCharsCrcSse42(const unsigned char* data, size_t size,
+                            uint64_t* counts, uint32_t& crc)
+    {
+        uint32_t c = ~crc;
+        countRuns<InstructionCrc>(data, size, counts, c);
+        crc = ~c;
+    }
+
+    __attribute__((target("avx2,bmi2")))
+    void countCharsCrcAvx2(const unsigned char* data, size_t size,
+                           uint64_t* counts, uint32_t& crc)
+    {
+        uint32_t c = ~crc;
+        countRuns<InstructionCrc>(data, size, counts, c);
+        crc = ~c;
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    void countCharsCrcAvx512(const unsigned char* data, size_t size,
+                             uint64_t* counts, uint32_t& crc)
+    {
+        uint32_t c = ~crc;
+        countRuns<InstructionCrc>(data, size, counts, c);
+        crc = ~c;
+    }
+}
@@ -0,0 +1,45 @@
+/* 
+ * File:   histogram.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Kernels that count the occurrences of each byte value in a buffer.
+ */
+
+#ifndef HISTOGRAM_H
+#define	HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman
+{
+    // Each variant adds the number of occurrences of each byte in data to
+    // counts, which must have 256 entries. They're the same portable code
+    // compiled for each instruction set, so they give identical results and
+    // run at much the same speed; use countChars (codebook.h) to get the one
+    // for this CPU.
+    void countCharsScalar(const unsigned char* data, size_t size,
+                          uint64_t* counts);
+    void countCharsSse42(const unsigned char* data, size_t size,
+                         uint64_t* counts);
+    void countCharsAvx2(const unsigned char* data, size_t size,
+                        uint64_t* counts);
+    void countCharsAvx512(const unsigned char* data, size_t size,
+                          uint64_t* counts);
+
+    // Each variant counts like the ones above and continues the CRC-32C crc
+    // over data in the same pass. From SSE4.2 up they compute the CRC with
+    // the crc32 instruction; use countCharsCrc (checksum.h) to get the best
+    // one for this CPU.
+    void countCharsCrcScalar(const unsigned char* data, size_t size,
+                             uint64_t* counts, uint32_t& crc);
+    void countCharsCrcSse42(const unsigned char* data, size_t size,
+                            uint64_t* counts, uint32_t& crc);
+    void countCharsCrcAvx2(const unsigned char* data, size_t size,
+                           uint64_t* counts, uint32_t& crc);
+    void countCharsCrcAvx512(const unsigned char* data, size_t size,
+                             uint64_t* counts, uint32_t& crc);
+}
+
+#endif	/* HISTOGRAM_H */
+
@@ -5,80 +5,92 @@
  * Created on August 13, 2012
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <fstream>
-#include <map>
-#include <queue>
+#include <string>
 #include <vector>
-#include <stdio.h>
-#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "huffman.h"
-#include "node.h"
-#include "bitFile.h"
+#include "bitPack.h"
+#include "bitReader.h"
+#include "block.h"
+#include "blockIndex.h"
+#include "blockSplit.h"
+#include "codebook.h"
+#include "decoder.h"
+#include "dictionary.h"
+#include "encoder.h"
+#include "parallel.h"
+#include "streamDecoder.h"
+#include "syncDecode.h"
 
 using std::fstream;
 using std::ios;
-using std::map;
 using std::vector;
-using std::priority_queue;
 
 namespace huffman
 {
     namespace
     {
-        class freqCompare
-        {
-        public:
-            bool operator() (const node* a, const node* b)
-            {
-                return a->freq > b->freq;
-            }
-        };
+        // the number of input bytes encode reads and packs at a time
+        const size_t chunkSize = 1 << 16;
         
-        struct codeword
-        {
-            char sym;
-            unsigned int code;
-            unsigned char bits; // number of bits in char code
-        };
+        // the fewest encoded bytes of a legacy file worth a thread of their
+        // own when decoding
+        const size_t minSegmentBytes = 1 << 18;
         
-        bool codewordCompare(const codeword& a, const codeword& b)
+        // Returns a heap-alloc'd fstream for the file
+        // pointed to by path, or NULL if the open fails.
+        // If input == true, opens the file in input mode,
+        // else opens the file in output mode.
+        fstream* openFile(const char* path, bool input)
         {
-            if(a.bits < b.bits) // sort first by code length
+            fstream* fileptr = new fstream();
+            fstream& file = *fileptr;
+            
+            if(input)
             {
-                return true;
+                file.open(path, ios::in | ios::binary);
             }
-            else if(a.bits > b.bits)
+            else
             {
-                return false;
+                file.open(path, ios::in | ios::out | ios::binary | ios::trunc);
             }
-            else if(a.sym <= b.sym) // ...then by symbol
+            
+            if(file.good())
             {
-                return true;
+                return fileptr;
             }
             else
             {
-                return false;
+                delete fileptr;
+                return NULL;
             }
         }
         
-        // Returns a heap-alloc'd fstream for the file
-        // pointed to by path, or NULL if the open fails.
-        // If input == true, opens the file in input mode,
-        // else opens the file in output mode.
-        fstream* openFile(const char* path, bool input)
+        // opens path for writing at its end, creating it if it doesn't
+        // exist. returns NULL if it can't be opened.
+        fstream* openAppend(const char* path)
         {
             fstream* fileptr = new fstream();
             fstream& file = *fileptr;
             
-            if(input)
-            {
-                file.open(path, ios::in);
-            }
-            else
+            file.open(path, ios::in | ios::out | ios::binary);
+            if(!file.is_open())
             {
-                file.open(path, ios::out | ios::trunc);
+                file.clear();
+                file.open(path, ios::in | ios::out | ios::binary | ios::trunc);
             }
+            file.seekp(0, ios::end);
             
             if(file.good())
             {
@@ -91,124 +103,898 @@ namespace huffman
             }
         }
         
-        // populates map<char,codeword> words with symbol-code pairs
-        // produced by traversing the tree rooted with given root
-        void getCodewords(vector<codeword>& words,
-                          const node& root,
-                          codeword currWord)
+        // reads up to chunkSize bytes from input into buf and
+        // returns the number of bytes read
+        size_t readChunk(std::istream& input, vector<unsigned char>& buf)
+        {
+            input.read((char*)buf.data(), chunkSize);
+            return input.gcount();
+        }
+    }
+    
+    // returns 0 if successful, 1 if inpath is invalid or not ASCII, 2 if
+    // outpath is invalid
+    char encodeLegacy(const char* inpath, const char* outpath)
+    {
+        // open inpath
+        fstream* inputptr = openFile(inpath, true);
+        if(!inputptr)
         {
-            if(root.children[0] == NULL && root.children[1] == NULL)
+            return 1; // inpath is invalid
+        }
+        fstream& input = *inputptr;
+        
+        // first count symbols
+        vector<unsigned char> inbuf(chunkSize);
+        uint64_t counts[numSymbols] = {0};
+        size_t numRead;
+        while((numRead = readChunk(input, inbuf)) > 0)
+        {
+            countChars(inbuf.data(), numRead, counts);
+        }
+        
+        // the codebook only has room for the first 128 symbols
+        for(unsigned int c = 128; c < numSymbols; c++)
+        {
+            if(counts[c] > 0)
             {
-                // we're at a leaf!
-                currWord.sym = root.sym;
-                words.push_back(currWord);
-                return;
+                input.close();
+                delete inputptr;
+                return 1; // inpath isn't ASCII
             }
-            else
+        }
+        
+        // open the output file
+        fstream* outputptr = openFile(outpath, false);
+        if(!outputptr)
+        {
+            input.close();
+            delete inputptr;
+            return 2; // outpath is invalid
+        }
+        fstream& output = *outputptr;
+        
+        // then construct the canonical Huffman code, flattening the counts
+        // until no codeword is too long for the table to hold
+        CodeTable table;
+        buildCodeTable(counts, table);
+        while(table.maxBits > maxCodeBits)
+        {
+            for(unsigned int c = 0; c < numSymbols; c++)
             {
-                // neither child is NULL, since an internal node MUST be
-                // constructed with 2 children
-                
-                codeword childWord;
-                childWord.bits = currWord.bits + 1;
-                childWord.code = currWord.code << 1;
-                
-                // before pushing a codeword into words,
-                // codeword.sym is initialized, so childWord.sym doesn't matter.
-                // To get the compiler to be quiet, let's just initialize to 0.
-                childWord.sym = 0;
+                counts[c] = counts[c] > 0 ? counts[c] / 2 + 1 : 0;
+            }
+            buildCodeTable(counts, table);
+        }
+        
+        vector<unsigned char> outbuf(packBound(table, chunkSize) + 128);
+        PackState state = {0, 0};
+        size_t numOut = 0;
+        
+        // The first 3 bits of the file are the number of unused bits in the
+        // final byte. They're filled in once we know how many there are.
+        numOut += putBits(state, 0, 3, outbuf.data());
+        
+        // write the codebook to output.
+        // because we're using a canonical Huffman code, only the code lengths
+        // need to be written if we write them in alphabetical order
+        for(unsigned char c = 0; c < 128; c++)
+        {
+            numOut += putBits(state, table.lens[c], 8, outbuf.data() + numOut);
+        }
+        unsigned char firstByte = outbuf[0];
+        
+        // translate input to a stream of bits using our codebook,
+        // and write the bits to output
+        input.clear();
+        input.seekg(0, ios::beg);
+        do
+        {
+            numRead = readChunk(input, inbuf);
+            numOut += packCodes(table, inbuf.data(), numRead, state,
+                                outbuf.data() + numOut);
+            output.write((const char*)outbuf.data(), numOut);
+            numOut = 0;
+        }
+        while(numRead > 0);
+        
+        unsigned char numUnused = (8 - state.bits) % 8;
+        numOut = flushBits(state, outbuf.data());
+        output.write((const char*)outbuf.data(), numOut);
+        
+        // now fill in the number of unused bits at the start of the file
+        output.seekp(0);
+        output.put(firstByte | numUnused << 5);
+        
+        // clean up
+        input.close();
+        output.close();
+        delete inputptr;
+        delete outputptr;
+        
+        return 0; // success
+    }
+    
+    namespace
+    {
+        // reads size bytes at offset of file descriptor fd into buf.
+        // returns false if they can't all be read.
+        bool readAt(int fd, unsigned char* buf, size_t size, uint64_t offset)
+        {
+            while(size > 0)
+            {
+                ssize_t n = pread(fd, buf, size, offset);
+                if(n <= 0)
+                {
+                    if(n < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                buf += n;
+                size -= n;
+                offset += n;
+            }
+            return true;
+        }
+        
+        // sizes the file fd (opened for reading and writing) to size bytes
+        // and maps it writable into map, so decoders can write straight into
+        // the page cache. the space is reserved first, so a full disk fails
+        // here rather than as a SIGBUS mid-decode. an empty file isn't
+        // mapped, leaving map NULL.
+        // returns false if the file can't be sized or mapped.
+        bool mapOutput(int fd, uint64_t size, unsigned char*& map)
+        {
+            map = NULL;
+            if(ftruncate(fd, size) != 0)
+            {
+                return false;
+            }
+            if(size == 0)
+            {
+                return true;
+            }
+            if(size > SIZE_MAX || posix_fallocate(fd, 0, size) != 0)
+            {
+                return false;
+            }
+            
+            void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                           0);
+            if(p == MAP_FAILED)
+            {
+                return false;
+            }
+            map = (unsigned char*)p;
+            return true;
+        }
+        
+        // writes back and unmaps the size bytes mapped by mapOutput at map.
+        // returns false if they can't be written back.
+        bool unmapOutput(unsigned char* map, uint64_t size)
+        {
+            if(!map)
+            {
+                return true;
+            }
+            bool synced = msync(map, size, MS_SYNC) == 0;
+            return munmap(map, size) == 0 && synced;
+        }
+        
+        // decodes the codewords from bit startBit to endBit of encoded into
+        // the file at outpath, split by planSegments (syncDecode.h) into
+        // numSegments segments that are decoded in parallel, each written
+        // straight to its place. table is used to plan the segments; multi,
+        // if given, to decode them.
+        // returns 0 if successful, 2 if outpath is invalid, 4 if the
+        // codewords are corrupt
+        char decodeSegments(const vector<unsigned char>& encoded,
+                            size_t startBit, size_t endBit,
+                            const DecodeTable& table,
+                            const MultiDecodeTable* multi,
+                            const char* outpath, unsigned int numSegments)
+        {
+            SegmentPlan plan;
+            if(!planSegments(table, encoded.data(), encoded.size(), startBit,
+                             endBit, numSegments, plan))
+            {
+                return 4;
+            }
+            
+            int output = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(output < 0)
+            {
+                return 2; // outpath is invalid
+            }
+            uint64_t outSize = plan.outOffsets[numSegments];
+            unsigned char* map;
+            if(!mapOutput(output, outSize, map))
+            {
+                close(output);
+                return 2;
+            }
+            
+            // each segment decodes straight into its place in the mapping
+            std::atomic<char> result(0);
+            parallelFor(numSegments, [&](size_t k)
+            {
+                size_t bitPos = plan.starts[k];
+                size_t segmentEnd = plan.starts[k + 1];
+                size_t want = plan.outOffsets[k + 1] - plan.outOffsets[k];
+                unsigned char* out = map + plan.outOffsets[k];
+                size_t n;
+                if(multi)
+                {
+                    n = decodeMultiSymbols(*multi, encoded.data(),
+                                           encoded.size(), bitPos, segmentEnd,
+                                           out, want);
+                }
+                else
+                {
+                    n = decodeSymbols(table, encoded.data(), encoded.size(),
+                                      bitPos, segmentEnd, out, want);
+                }
                 
-                getCodewords(words, *(root.children[0]), childWord);
+                if(n != want || bitPos != segmentEnd)
+                {
+                    result = 4;
+                }
+            }, numSegments);
+            
+            if(!unmapOutput(map, outSize) && result == 0)
+            {
+                result = 2;
+            }
+            if(close(output) != 0 && result == 0)
+            {
+                result = 2;
+            }
+            return result;
+        }
+        
+        // decodes a file in the legacy single-stream format, on up to
+        // threads threads (one per core if 0) if it's long enough.
+        // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is
+        // invalid, 4 if the input file is corrupt
+        char decodeLegacy(const char* inpath, const char* outpath,
+                          unsigned int threads)
+        {
+            // read the whole encoded file
+            fstream* inputptr = openFile(inpath, true);
+            if(!inputptr)
+            {
+                return 1; // inpath is invalid
+            }
+            fstream& input = *inputptr;
+            vector<unsigned char> encoded;
+            vector<unsigned char> inbuf(chunkSize);
+            size_t numRead;
+            while((numRead = readChunk(input, inbuf)) > 0)
+            {
+                encoded.insert(encoded.end(), inbuf.begin(),
+                               inbuf.begin() + numRead);
+            }
+            input.close();
+            delete inputptr;
+            
+            // the 3 bits giving the number of unused bits at the end, then the
+            // lengths of the codewords of the 128 symbols
+            const size_t headerBits = 3 + 128 * 8;
+            if(encoded.size() * 8 < headerBits)
+            {
+                return 4; // too short to be an encoded file
+            }
+            size_t endBit = encoded.size() * 8 - (encoded[0] >> 5);
+            if(endBit < headerBits)
+            {
+                return 4; // more unused bits than there are after the header
+            }
+            
+            BitReader header(encoded.data(), encoded.size(), 3);
+            unsigned char lengths[128];
+            for(int c = 0; c < 128; c++)
+            {
+                lengths[c] = header.read(8);
+            }
+            CanonicalCode* codeptr = new CanonicalCode();
+            CanonicalCode& code = *codeptr;
+            if(!buildCanonicalCode(lengths, 128, code)
+               || (code.numCodes == 0 && endBit > headerBits))
+            {
+                delete codeptr;
+                return 4;
+            }
+            
+            // Decode several symbols per lookup if the codewords are short
+            MultiDecodeTable* multiptr = NULL;
+            DecodeTable* tableptr = NULL;
+            if(code.numCodes > 0 && preferMultiDecode(code))
+            {
+                multiptr = new MultiDecodeTable();
+                buildMultiDecodeTable(code, *multiptr);
+            }
+            else if(code.numCodes > 0)
+            {
+                tableptr = new DecodeTable();
+                if(!buildDecodeTable(code, *tableptr))
+                {
+                    delete tableptr;
+                    delete codeptr;
+                    return 4;
+                }
+            }
+            
+            // Long streams are cut into segments decoded in parallel
+            size_t numSegments = threads > 0 ? threads : defaultThreads();
+            size_t maxSegments = (endBit - headerBits) / (minSegmentBytes * 8);
+            numSegments = numSegments < maxSegments ? numSegments
+                                                    : maxSegments;
+            if(numSegments > 1 && code.numCodes > 0)
+            {
+                // planning walks codeword lengths, so it needs a DecodeTable
+                DecodeTable* planptr = tableptr;
+                if(!planptr)
+                {
+                    planptr = new DecodeTable();
+                    if(!buildDecodeTable(code, *planptr))
+                    {
+                        delete planptr;
+                        delete multiptr;
+                        delete codeptr;
+                        return 4;
+                    }
+                }
+                char result = decodeSegments(encoded, headerBits, endBit,
+                                             *planptr, multiptr, outpath,
+                                             numSegments);
                 
-                childWord.code++;
-                getCodewords(words, *(root.children[1]), childWord);
+                if(planptr != tableptr)
+                {
+                    delete planptr;
+                }
+                delete multiptr;
+                delete tableptr;
+                delete codeptr;
+                return result;
             }
+            
+            fstream* outputptr = openFile(outpath, false);
+            if(!outputptr)
+            {
+                delete multiptr;
+                delete tableptr;
+                delete codeptr;
+                return 2; // outpath is invalid
+            }
+            fstream& output = *outputptr;
+            
+            // decode a chunk at a time until we reach the unused bits
+            char result = 0;
+            size_t bitPos = headerBits;
+            vector<unsigned char> outbuf(chunkSize);
+            while(bitPos < endBit)
+            {
+                size_t n;
+                if(multiptr)
+                {
+                    n = decodeMultiSymbols(*multiptr, encoded.data(),
+                                           encoded.size(), bitPos, endBit,
+                                           outbuf.data(), chunkSize);
+                }
+                else
+                {
+                    n = decodeSymbols(*tableptr, encoded.data(), encoded.size(),
+                                      bitPos, endBit, outbuf.data(), chunkSize);
+                }
+            
+                if(n == 0 || bitPos > endBit)
+                {
+                    result = 4; // a codeword was invalid or cut off
+                    break;
+                }
+                output.write((const char*)outbuf.data(), n);
+            }
+            
+            // clean up
+            output.close();
+            delete outputptr;
+            delete multiptr;
+            delete tableptr;
+            delete codeptr;
+            
+            return result;
         }
         
-        // populates counts with character counts and returns the total
-        // number of characters
-        unsigned int countChars(fstream& input, map<char, double>& counts)
+        // the blocks of every frame of an indexed file, in order
+        struct FileBlocks
         {
-            char c;
-            unsigned int total = 0;
+            vector<IndexEntry> entries; // offsets from the start of the file
+            vector<uint64_t> ends;      // where each block ends
+            vector<size_t> firsts;      // the first block of each's frame
             
-            while(input.get(c))
+            // the shared codes each block can select, built once per frame
+            vector<std::shared_ptr<const SharedCodes>> shared;
+        };
+        
+        // reads the shared codes block whose header is header, at offset
+        // of the indexed file open as input, into context.
+        // returns false if it's corrupt.
+        bool readSharedCodes(int input, const BlockHeader& header,
+                             uint64_t offset, CodeContext& context)
+        {
+            if(header.payloadSize > blockChecksumSize + 1
+                                    + maxSharedCodes * maxCodebookSize)
             {
-                counts[c]++;
-                total++;
+                return false;
+            }
+            vector<unsigned char> codes(header.payloadSize);
+            return readAt(input, codes.data(), codes.size(),
+                          offset + blockHeaderSize)
+                   && decodeBlock(header, codes.data(), NULL, &context);
+        }
+        
+        // reads the frame at offset pos of the indexed file (blockIndex.h)
+        // open as input, fileSize bytes long, whose header is frame and
+        // gives its length, appending its blocks to blocks and setting pos
+        // to where it ends. Its blocks are found from its index, and only
+        // the first one is read, for the codes the rest may share.
+        // returns false if the frame is corrupt.
+        bool readFrame(int input, uint64_t fileSize, const FrameHeader& frame,
+                       uint64_t& pos, FileBlocks& blocks)
+        {
+            unsigned char trailer[indexTrailerSize];
+            uint64_t numBlocks;
+            uint64_t indexOffset;
+            if(frame.length > fileSize - pos
+               || frame.length < frame.size + indexTrailerSize
+               || !readAt(input, trailer, indexTrailerSize,
+                          pos + frame.length - indexTrailerSize)
+               || !readIndexTrailer(trailer, frame.length, frame.size,
+                                    numBlocks, indexOffset))
+            {
+                return false;
+            }
+            vector<unsigned char> index(numBlocks * indexEntrySize);
+            vector<IndexEntry> entries;
+            if(!readAt(input, index.data(), index.size(), pos + indexOffset)
+               || !readIndex(index.data(), numBlocks, frame.size, indexOffset,
+                             entries))
+            {
+                return false;
             }
             
-            return total;
+            // the blocks after shared codes select from their tables
+            CodeContext context;
+            unsigned char headerData[blockHeaderSize];
+            BlockHeader header;
+            if(!readAt(input, headerData, blockHeaderSize, pos + frame.size)
+               || !readBlockHeader(headerData, blockHeaderSize, header)
+               || (header.type == blockSharedCodes
+                   && !readSharedCodes(input, header, pos + frame.size,
+                                       context)))
+            {
+                return false;
+            }
+            
+            size_t first = blocks.entries.size();
+            uint64_t contentSize = 0;
+            for(size_t i = 0; i < numBlocks; i++)
+            {
+                IndexEntry entry = {pos + entries[i].offset,
+                                    entries[i].rawSize};
+                blocks.entries.push_back(entry);
+                blocks.ends.push_back(pos + (i + 1 < numBlocks
+                                             ? entries[i + 1].offset
+                                             : indexOffset));
+                blocks.firsts.push_back(first);
+                blocks.shared.push_back(context.shared);
+                contentSize += entries[i].rawSize;
+            }
+            
+            // a given content size has to match the blocks
+            pos += frame.length;
+            return !(frame.flags & frameContentSize)
+                   || contentSize == frame.contentSize;
         }
         
-        // returns the heap-alloc'd root of the Huffman tree
-        node* constructTree(map<char, double>& counts, unsigned int total)
+        // reads a frame like readFrame, for the frames of older versions,
+        // which don't give their length. Its blocks are found by walking
+        // their headers, and its index has to agree.
+        // returns false if the frame is corrupt.
+        bool readUnsizedFrame(int input, uint64_t fileSize,
+                              const FrameHeader& frame, uint64_t& pos,
+                              FileBlocks& blocks)
         {
-            // first create a leaf node for each symbol and add it to a
-            // priority queue
-            priority_queue<node*, vector<node*>, freqCompare> pq;
+            size_t first = blocks.entries.size();
+            uint64_t offset = pos + frame.size;
+            uint64_t contentSize = 0;
+            CodeContext context;
+            BlockHeader header;
+            do
+            {
+                unsigned char headerData[blockHeaderSize];
+                if(!readAt(input, headerData, blockHeaderSize, offset)
+                   || !readBlockHeader(headerData, blockHeaderSize, header)
+                   || (header.type == blockSharedCodes
+                       && !readSharedCodes(input, header, offset, context)))
+                {
+                    return false;
+                }
+                
+                IndexEntry entry = {offset, header.rawSize};
+                blocks.entries.push_back(entry);
+                offset += blockHeaderSize + header.payloadSize;
+                blocks.ends.push_back(offset);
+                blocks.firsts.push_back(first);
+                blocks.shared.push_back(context.shared);
+                contentSize += header.rawSize;
+            }
+            while(!header.last && offset < fileSize);
+            uint64_t numBlocks = blocks.entries.size() - first;
+            uint64_t indexSize = numBlocks * indexEntrySize + indexTrailerSize;
+            if(!header.last || offset + indexSize > fileSize)
+            {
+                return false;
+            }
+            vector<unsigned char> index(indexSize);
+            uint64_t indexBlocks;
+            uint64_t indexOffset;
+            vector<IndexEntry> entries;
+            if(!readAt(input, index.data(), indexSize, offset)
+               || !readIndexTrailer(index.data() + indexSize
+                                    - indexTrailerSize,
+                                    offset + indexSize - pos, frame.size,
+                                    indexBlocks, indexOffset)
+               || indexBlocks != numBlocks || indexOffset != offset - pos
+               || !readIndex(index.data(), numBlocks, frame.size,
+                             indexOffset, entries))
+            {
+                return false;
+            }
+            for(size_t i = 0; i < numBlocks; i++)
+            {
+                const IndexEntry& found = blocks.entries[first + i];
+                if(entries[i].offset + pos != found.offset
+                   || entries[i].rawSize != found.rawSize)
+                {
+                    return false;
+                }
+            }
+            
+            // a given content size has to match the blocks
+            pos = offset + indexSize;
+            return !(frame.flags & frameContentSize)
+                   || contentSize == frame.contentSize;
+        }
         
-            typedef map<char, double>::iterator it_char_doub_type;
-            for(it_char_doub_type it = counts.begin(); it != counts.end(); it++)
+        // reads the blocks of every frame of the indexed file (blockIndex.h)
+        // open as input into blocks, passing over skippable frames.
+        // returns 0 if successful, 4 if the file or an index is corrupt, 5
+        // if it isn't an indexed file, 6 if a frame is of a newer format
+        // version
+        char readFileIndex(int input, FileBlocks& blocks)
+        {
+            struct stat info;
+            if(fstat(input, &info) != 0)
             {
-                double freq = it->second / total;
-
-                node* newnode = new node(freq, it->first);
-
-                pq.push(newnode);
+                return 4;
             }
-
-            // pop nodes from queue to construct Huffman tree
-            while(pq.size() > 1)
+            uint64_t fileSize = info.st_size;
+            
+            uint64_t pos = 0;
+            do
             {
-                node* a = pq.top();
-                pq.pop();
-                node* b = pq.top();
-                pq.pop();
-
-                node* internalNode = new node(a, b);
-                pq.push(internalNode);
+                unsigned char head[frameHeaderSize];
+                size_t headSize = fileSize - pos < frameHeaderSize
+                                  ? fileSize - pos : frameHeaderSize;
+                FrameHeader frame;
+                if(!readAt(input, head, headSize, pos))
+                {
+                    return 4;
+                }
+                switch(readFrameHeader(head, headSize, frame))
+                {
+                    case frameOk:
+                        if(!((frame.flags & frameLength)
+                             ? readFrame(input, fileSize, frame, pos, blocks)
+                             : readUnsizedFrame(input, fileSize, frame, pos,
+                                                blocks)))
+                        {
+                            return 4;
+                        }
+                        break;
+                    case frameSkippable:
+                        pos += frame.size + frame.contentSize;
+                        if(pos > fileSize)
+                        {
+                            return 4;
+                        }
+                        break;
+                    case frameUnsupported:
+                        return 6;
+                    case frameShort:
+                        return pos > 0 || isIndexedFile(head, headSize) ? 4
+                                                                        : 5;
+                    default:
+                        return pos > 0 ? 4 : 5;
+                }
+            }
+            while(pos < fileSize);
+            return 0;
+        }
+        
+        // reads block i of the indexed file open as input, whose blocks are
+        // blocks, and decodes it into out, which must have room for its
+        // rawSize bytes.
+        // returns false if the block is corrupt.
+        bool decodeFileBlock(int input, const FileBlocks& blocks, size_t i,
+                             unsigned char* out)
+        {
+            const vector<IndexEntry>& entries = blocks.entries;
+            size_t size = blocks.ends[i] - entries[i].offset;
+            if(size > blockBound(maxBlockSize))
+            {
+                return false;
             }
-            node* root = pq.top();
             
-            return root;
+            vector<unsigned char> block(size);
+            BlockHeader header;
+            if(!readAt(input, block.data(), size, entries[i].offset)
+               || !readBlockHeader(block.data(), size, header)
+               || blockHeaderSize + header.payloadSize != size
+               || header.rawSize != entries[i].rawSize)
+            {
+                return false;
+            }
+            const unsigned char* body = block.data() + blockHeaderSize;
+            CodeContext context;
+            context.shared = blocks.shared[i];
+            if(!repeatsCode(header, body))
+            {
+                return decodeBlock(header, body, out, &context);
+            }
+            
+            // find the code it repeats in one of the blocks just before it
+            unsigned char codebook[blockHeaderSize + blockChecksumSize
+                                   + maxCodebookSize];
+            for(size_t j = i; j > blocks.firsts[i] && i - j < maxRepeatRun; j--)
+            {
+                size_t length = blocks.ends[j - 1] - entries[j - 1].offset;
+                length = length < sizeof(codebook) ? length : sizeof(codebook);
+                BlockHeader previous;
+                if(!readAt(input, codebook, length, entries[j - 1].offset)
+                   || !readBlockHeader(codebook, length, previous))
+                {
+                    return false;
+                }
+                if(readBlockCode(previous, codebook + blockHeaderSize,
+                                 length - blockHeaderSize, context))
+                {
+                    context.sinceCode = i - j;
+                    break;
+                }
+            }
+            return decodeBlock(header, body, out, &context);
         }
         
-        // turns any Huffman code into a canonical one.
-        // returns a heap-alloc'd codebook for this new code
-        map<char, codeword>* canonize(vector<codeword>& words)
+        // reads input through from its start, splitting it into blocks of
+        // at most blockSize bytes just as the encoder will, and chooses the
+        // codes those blocks can share from their byte counts, leaving input
+        // at its start again. Only a run of maxRepeatRun blocks in every few
+        // is kept, so no more than about maxSharedSamples are. returns
+        // nothing, without reading input, if its blocks are too long or too
+        // few for sharing to pay, and nothing if sharing doesn't pay or
+        // input can't be read twice.
+        std::shared_ptr<const SharedCodes> sharedCodesFor(fstream& input,
+                                                          size_t blockSize)
         {
-            std::sort(words.begin(), words.end(), codewordCompare);
-
-            map<char, codeword>* bookptr = new map<char, codeword>();
-            map<char, codeword>& book = *bookptr;
-
-            words[0].code = 0; // first word is zero
-            book[words[0].sym] = words[0];
-            for(unsigned int i = 1; i < words.size(); i++)
+            input.seekg(0, ios::end);
+            std::streamoff size = input.tellg();
+            input.seekg(0);
+            if(!input.good() || size <= 0 || blockSize > maxSharedBlockSize
+               || (uint64_t)size / blockSize < minSharedBlocks)
             {
-                // each word is one greater than last
-                words[i].code = words[i-1].code + 1;
-
-                // if a word is longer than the previous one,
-                // left shift until it's the appropriate length
-                if(words[i].bits > words[i-1].bits)
+                input.clear();
+                input.seekg(0);
+                return nullptr;
+            }
+            
+            // whole runs are kept, so the blocks kept can still repeat the
+            // codes of the ones before them
+            uint64_t numRuns = size / blockSize / maxRepeatRun + 1;
+            uint64_t every = numRuns * maxRepeatRun / maxSharedSamples + 1;
+            vector<Histogram> pieces;
+            uint64_t numBlocks = 0;
+            vector<unsigned char> pending;
+            pending.reserve(blockSize);
+            auto split = [&]()
+            {
+                Histogram counts;
+                size_t n = chooseBlockEnd(pending.data(), pending.size(),
+                                          counts.data());
+                if((numBlocks / maxRepeatRun) % every == 0)
                 {
-                    for(int j = words[i-1].bits; j < words[i].bits; j++)
+                    pieces.push_back(counts);
+                }
+                numBlocks++;
+                pending.erase(pending.begin(), pending.begin() + n);
+            };
+            
+            vector<unsigned char> inbuf(chunkSize);
+            size_t numRead;
+            uint64_t offset = 0;
+            while((numRead = readChunk(input, inbuf)) > 0)
+            {
+                for(size_t i = 0; i < numRead; )
+                {
+                    size_t n = blockSize - pending.size();
+                    n = n < numRead - i ? n : numRead - i;
+                    pending.insert(pending.end(), inbuf.begin() + i,
+                                   inbuf.begin() + i + n);
+                    i += n;
+                    if(pending.size() == blockSize)
                     {
-                        words[i].code = words[i].code << 1;
+                        split();
                     }
                 }
-
-                book[words[i].sym] = words[i];
+                offset += numRead;
+            }
+            
+            // the rest may still split in several
+            while(!pending.empty())
+            {
+                split();
+            }
+            input.clear();
+            input.seekg(0);
+            if(offset != (uint64_t)size || !input.good())
+            {
+                return nullptr;
+            }
+            return chooseSharedCodes(pieces, every);
+        }
+        
+        // encodes input onto the end of output as one frame of an indexed
+        // file (blockIndex.h), of blockSize-byte blocks with checksums if
+        // checksum is true.
+        // returns false if output can't be written.
+        bool encodeFrame(fstream& input, fstream& output, size_t blockSize,
+                         bool checksum)
+        {
+            // encode a block at a time, noting where each one lands
+            vector<IndexEntry> index;
+            uint64_t offset = frameHeaderSize;
+            uint64_t contentSize = 0;
+            Encoder encoder([&](const unsigned char* data, size_t size)
+            {
+                BlockHeader header;
+                readBlockHeader(data, size, header);
+                IndexEntry entry = {offset, header.rawSize};
+                index.push_back(entry);
+                output.write((const char*)data, size);
+                offset += size;
+                contentSize += header.rawSize;
+                return output.good();
+            }, blockSize, checksum);
+            
+            // the content size and length are filled in once they're known
+            std::streampos start = output.tellp();
+            FrameHeader frame;
+            frame.flags = frameContentSize | frameLength
+                          | (checksum ? frameChecksums : 0);
+            frame.blockSize = encoder.getBlockSize();
+            frame.contentSize = 0;
+            frame.length = 0;
+            unsigned char frameData[frameHeaderSize];
+            putFrameHeader(frame, frameData);
+            output.write((const char*)frameData, sizeof(frameData));
+            
+            // a first pass finds the codes the blocks can share
+            std::shared_ptr<const SharedCodes> shared =
+                sharedCodesFor(input, encoder.getBlockSize());
+            bool success = !shared || encoder.shareCodes(shared);
+            
+            vector<unsigned char> inbuf(chunkSize);
+            size_t numRead;
+            while(success && (numRead = readChunk(input, inbuf)) > 0)
+            {
+                success = encoder.push(inbuf.data(), numRead);
+            }
+            success = success && encoder.finish();
+            
+            // then the index, so the blocks can be found without a scan
+            if(success)
+            {
+                vector<unsigned char> tail;
+                putIndex(index, tail);
+                output.write((const char*)tail.data(), tail.size());
+            
+                frame.contentSize = contentSize;
+                frame.length = offset + tail.size();
+                putFrameHeader(frame, frameData);
+                output.seekp(start);
+                output.write((const char*)frameData, sizeof(frameData));
+                success = output.good();
+            }
+            return success;
+        }
+        
+        // decodes an indexed file (blockIndex.h), spreading its blocks over
+        // threads worker threads, each of which writes what it decodes
+        // straight to its place in the output file.
+        // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is
+        // invalid, 4 if the input file is corrupt, 6 if it's of a newer
+        // format version
+        char decodeIndexed(const char* inpath, const char* outpath,
+                           unsigned int threads)
+        {
+            int input = open(inpath, O_RDONLY);
+            if(input < 0)
+            {
+                return 1; // inpath is invalid
+            }
+            
+            FileBlocks blocks;
+            char status = readFileIndex(input, blocks);
+            if(status != 0)
+            {
+                close(input);
+                return status;
+            }
+            const vector<IndexEntry>& entries = blocks.entries;
+            size_t numBlocks = entries.size();
+            
+            // each block's output goes right after the previous block's
+            vector<uint64_t> outOffsets(numBlocks + 1, 0);
+            for(size_t i = 0; i < numBlocks; i++)
+            {
+                outOffsets[i + 1] = outOffsets[i] + entries[i].rawSize;
+            }
+            
+            int output = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(output < 0)
+            {
+                close(input);
+                return 2; // outpath is invalid
+            }
+            unsigned char* map;
+            if(!mapOutput(output, outOffsets[numBlocks], map))
+            {
+                close(input);
+                close(output);
+                return 2;
             }
             
-            return bookptr;
+            // the first failure wins; the other workers stop early. each
+            // block decodes straight into its place in the mapping.
+            std::atomic<char> result(0);
+            parallelFor(numBlocks, [&](size_t i)
+            {
+                if(result.load() == 0
+                   && !decodeFileBlock(input, blocks, i, map + outOffsets[i]))
+                {
+                    result = 4;
+                }
+            }, threads);
+            
+            close(input);
+            if(!unmapOutput(map, outOffsets[numBlocks]) && result == 0)
+            {
+                result = 2;
+            }
+            if(close(output) != 0 && result == 0)
+            {
+                result = 2;
+            }
+            return result;
         }
     }
     
     // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is invalid
-    char encode(const char* inpath, const char* outpath)
+    char encode(const char* inpath, const char* outpath, size_t blockSize,
+                bool checksum)
     {
         // open inpath
         fstream* inputptr = openFile(inpath, true);
@@ -218,118 +1004,400 @@ namespace huffman
         }
         fstream& input = *inputptr;
         
-        // create BitFileOut and open the output file in it
-        BitFileOut* outputptr = new BitFileOut();
-        BitFileOut& output = *outputptr;
-        if(!output.open(outpath))
+        // open the output file
+        fstream* outputptr = openFile(outpath, false);
+        if(!outputptr)
         {
             input.close();
             delete inputptr;
-            delete outputptr;
             return 2; // outpath is invalid
         }
+        fstream& output = *outputptr;
         
+        bool success = encodeFrame(input, output, blockSize, checksum);
         
-        // first count symbols
-        map<char, double> counts;
-        unsigned int total = countChars(input, counts);
-
-        // then construct Huffman tree
-        node* root = constructTree(counts, total);
+        // clean up
+        input.close();
+        output.close();
+        delete inputptr;
+        delete outputptr;
+        
+        return success ? 0 : 2;
+    }
+    
+    // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is invalid
+    char encodeAppend(const char* inpath, const char* outpath,
+                      size_t blockSize, bool checksum)
+    {
+        fstream* inputptr = openFile(inpath, true);
+        if(!inputptr)
+        {
+            return 1; // inpath is invalid
+        }
+        fstream& input = *inputptr;
+        
+        // the new frame goes after whatever is already there
+        fstream* outputptr = openAppend(outpath);
+        if(!outputptr)
+        {
+            input.close();
+            delete inputptr;
+            return 2; // outpath is invalid
+        }
+        fstream& output = *outputptr;
         
-        // construct codebook by traversing tree
-        vector<codeword>* wordsptr = new vector<codeword>();
-        vector<codeword>& words = *wordsptr;
+        bool success = encodeFrame(input, output, blockSize, checksum);
         
-        codeword initWord;
-        initWord.code = initWord.bits = initWord.sym = 0;
+        // clean up
+        input.close();
+        output.close();
+        delete inputptr;
+        delete outputptr;
         
-        getCodewords(words, *root, initWord);
-        delete root;
+        return success ? 0 : 2;
+    }
+    
+    // returns 0 if successful, 1 if size is too large, 2 if outpath is
+    // invalid
+    char appendMetadata(const char* outpath, const unsigned char* data,
+                        size_t size)
+    {
+        if(size > UINT32_MAX)
+        {
+            return 1;
+        }
+        fstream* outputptr = openAppend(outpath);
+        if(!outputptr)
+        {
+            return 2; // outpath is invalid
+        }
+        fstream& output = *outputptr;
         
-        // put this Huffman code in canonical form
-        map<char, codeword>* bookptr = canonize(words);
-        map<char, codeword>& book = *bookptr;
-        delete wordsptr; // we no longer need the old codebook
+        unsigned char header[skippableHeaderSize];
+        putSkippableHeader(size, header);
+        output.write((const char*)header, sizeof(header));
+        output.write((const char*)data, size);
+        bool success = output.good();
         
-        // write the codebook to output.
-        // because we're using a canonical Huffman code, only the code lengths
-        // need to be written if we write them in alphabetical order
-        typedef map<char, codeword>::iterator it_char_code_type;
-        it_char_code_type it = book.begin();
-        for(unsigned char c = 0; c < 128; c++)
+        output.close();
+        delete outputptr;
+        
+        return success ? 0 : 2;
+    }
+    
+    // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is
+    // invalid, 4 if the input file is corrupt, 6 if it's of a newer version
+    char decode(const char* inpath, const char* outpath,
+                unsigned int threads)
+    {
+        // tell the formats apart by their first bytes
+        fstream* inputptr = openFile(inpath, true);
+        if(!inputptr)
         {
-            char sym = (it == book.end()) ? 0 : it->first;
-            char code = (it == book.end()) ? 0 : it->second.code;
-            char bits = (it == book.end()) ? 0 : it->second.bits;
+            return 1; // inpath is invalid
+        }
+        unsigned char magic[sizeof(fileMagic)];
+        inputptr->read((char*)magic, sizeof(magic));
+        size_t numRead = inputptr->gcount();
+        inputptr->close();
+        delete inputptr;
+        
+        if(isIndexedFile(magic, numRead))
+        {
+            return decodeIndexed(inpath, outpath, threads);
+        }
+        return decodeLegacy(inpath, outpath, threads);
+    }
+    
+    // returns 0 if successful, 1 if input can't be read, 2 if output can't
+    // be written, 4 if the input is corrupt
+    char decode(std::istream& input, std::ostream& output)
+    {
+        bool outputFailed = false;
+        StreamDecoder decoder([&](const unsigned char* data, size_t size)
+        {
+            output.write((const char*)data, size);
+            outputFailed = !output.good();
+            return !outputFailed;
+        });
+        
+        // hand the decoder a chunk at a time until the input runs out
+        vector<unsigned char> inbuf(chunkSize);
+        size_t numRead;
+        bool success = true;
+        while(success && (numRead = readChunk(input, inbuf)) > 0)
+        {
+            success = decoder.push(inbuf.data(), numRead);
+        }
+        
+        if(input.bad())
+        {
+            return 1;
+        }
+        if(outputFailed)
+        {
+            return 2;
+        }
+        if(!success || !decoder.finish())
+        {
+            return 4;
+        }
+        output.flush();
+        return output.good() ? 0 : 2;
+    }
+    
+    // returns 0 if successful, 1 if inpath is invalid, 4 if the input file
+    // is corrupt, 5 if it's a legacy file, 6 if it's of a newer version
+    char decodeRange(const char* inpath, uint64_t offset, size_t length,
+                     unsigned char* out, size_t& written)
+    {
+        written = 0;
+        int input = open(inpath, O_RDONLY);
+        if(input < 0)
+        {
+            return 1; // inpath is invalid
+        }
+        
+        // a legacy file has no index to seek with
+        FileBlocks blocks;
+        char status = readFileIndex(input, blocks);
+        if(status != 0)
+        {
+            close(input);
+            return status;
+        }
+        
+        const vector<IndexEntry>& entries = blocks.entries;
+        
+        // the range is cut short at the end of the decoded data
+        vector<uint64_t> outOffsets(entries.size() + 1, 0);
+        for(size_t i = 0; i < entries.size(); i++)
+        {
+            outOffsets[i + 1] = outOffsets[i] + entries[i].rawSize;
+        }
+        uint64_t totalSize = outOffsets[entries.size()];
+        offset = offset < totalSize ? offset : totalSize;
+        length = length < totalSize - offset ? length : totalSize - offset;
+        
+        // only the blocks that hold part of the range are decoded
+        size_t first = std::upper_bound(outOffsets.begin(), outOffsets.end(),
+                                        offset) - outOffsets.begin() - 1;
+        size_t last = first;
+        while(last < entries.size() && outOffsets[last] < offset + length)
+        {
+            last++;
+        }
+        
+        // blocks the range covers whole decode straight into out; the ones
+        // at its ends decode aside and have their part copied
+        std::atomic<char> result(0);
+        parallelFor(last - first, [&](size_t k)
+        {
+            size_t i = first + k;
+            uint64_t from = outOffsets[i] > offset ? outOffsets[i] : offset;
+            uint64_t to = outOffsets[i + 1] < offset + length
+                          ? outOffsets[i + 1] : offset + length;
+            unsigned char* dest = out + (from - offset);
+            if(result.load() != 0)
+            {
+                return;
+            }
+            if(from == outOffsets[i] && to == outOffsets[i + 1])
+            {
+                if(!decodeFileBlock(input, blocks, i, dest))
+                {
+                    result = 4;
+                }
+                return;
+            }
             
-            if(it != book.end() && sym == c)
+            vector<unsigned char> raw(entries[i].rawSize);
+            if(!decodeFileBlock(input, blocks, i, raw.data()))
             {
-                output.writeByte(bits);
-                
-                // test this function so far by printing codebook
-                printf("Sym: %c\nCode: %x\nBits: %d\n\n", sym, code, bits);
-                
-                it++;
+                result = 4;
+                return;
             }
-            else
+            std::copy(raw.begin() + (from - outOffsets[i]),
+                      raw.begin() + (to - outOffsets[i]), dest);
+        });
+        
+        close(input);
+        if(result == 0)
+        {
+            written = length;
+        }
+        return result;
+    }
+    
+    // returns 0 if every block is intact, 1 if inpath is invalid, 4 if the
+    // input file is corrupt, 5 if it's a legacy file, 6 if it's of a newer
+    // version
+    char verify(const char* inpath, unsigned int threads)
+    {
+        int input = open(inpath, O_RDONLY);
+        if(input < 0)
+        {
+            return 1; // inpath is invalid
+        }
+        
+        // a legacy file has no blocks to check on their own
+        FileBlocks blocks;
+        char status = readFileIndex(input, blocks);
+        if(status != 0)
+        {
+            close(input);
+            return status;
+        }
+        
+        const vector<IndexEntry>& entries = blocks.entries;
+        
+        // each block decodes aside, checking its checksum, and is dropped
+        std::atomic<char> result(0);
+        parallelFor(entries.size(), [&](size_t i)
+        {
+            vector<unsigned char> raw(entries[i].rawSize);
+            if(result.load() == 0
+               && !decodeFileBlock(input, blocks, i, raw.data()))
+            {
+                result = 4;
+            }
+        }, threads);
+        
+        close(input);
+        return result;
+    }
+    
+    // returns 0 if successful, 1 if dirpath is invalid or holds no files
+    char train(const char* dirpath, unsigned int numDicts,
+               vector<TrainedDictionary>& trained, unsigned int threads)
+    {
+        DIR* dir = opendir(dirpath);
+        if(!dir)
+        {
+            return 1; // dirpath is invalid
+        }
+        vector<std::string> paths;
+        while(dirent* entry = readdir(dir))
+        {
+            std::string path = std::string(dirpath) + "/" + entry->d_name;
+            struct stat info;
+            if(stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
             {
-                output.writeByte(0);
+                paths.push_back(path);
             }
         }
+        closedir(dir);
+        if(paths.empty())
+        {
+            return 1;
+        }
         
-        // translate input to a stream of bits using our codebook,
-        // and write the bits to 
-        input.clear();
-        input.seekg(0, ios::beg);
-        char c;
-        while(input.get(c))
+        // count each sample on its own, so they can be told apart
+        vector<Histogram> samples(paths.size(), Histogram());
+        std::atomic<char> result(0);
+        parallelFor(paths.size(), [&](size_t i)
         {
-            codeword word = book[c];
-            
-            unsigned char bits = word.bits;
-            unsigned int code = word.code;
-            
-            unsigned int mask = 0x01;
-            mask <<= bits - 1; // results in a 1 at the most sig. bit of code
-            
-            for(int i = 0; i < bits; i++)
+            fstream* inputptr = openFile(paths[i].c_str(), true);
+            if(!inputptr)
             {
-                if((mask & code) == 0)
-                {
-                    output.writeBit(0);
-                }
-                else
-                {
-                    output.writeBit(1);
-                }
-                mask >>= 1;
+                result = 1;
+                return;
+            }
+            vector<unsigned char> inbuf(chunkSize);
+            size_t numRead;
+            while((numRead = readChunk(*inputptr, inbuf)) > 0)
+            {
+                countChars(inbuf.data(), numRead, samples[i].data());
             }
+            inputptr->close();
+            delete inputptr;
+        }, threads);
+        if(result != 0)
+        {
+            return result;
         }
         
-        // clean up
-        input.close();
-        output.close();
-        delete inputptr;
-        delete outputptr;
-        delete bookptr;
+        trainDictionaries(samples, numDicts, trained, threads);
+        return 0;
+    }
+    
+    size_t compressBound(size_t inSize)
+    {
+        // blocks end on split granules or the end of the input, and take at
+        // most a header and checksum more than their input, since input a
+        // code wouldn't shrink is stored
+        size_t numBlocks = inSize / splitGranule + 1;
+        return numBlocks * (blockHeaderSize + blockChecksumSize) + inSize;
+    }
+    
+    // returns 0 if successful, 3 if out is too small
+    char encodeBuffer(const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity, size_t& written)
+    {
+        written = 0;
+        
+        // emit full blocks, then whatever is left (maybe nothing) as the
+        // last block
+        CodeContext context;
+        bool last = false;
+        while(!last)
+        {
+            size_t size = inSize < defaultBlockSize ? inSize : defaultBlockSize;
+            uint64_t counts[numSymbols];
+            size = chooseBlockEnd(in, size, counts);
+            last = size == inSize && size < defaultBlockSize;
+            
+            size_t n = encodeBlock(in, size, last, out + written,
+                                   outCapacity - written, &context, false,
+                                   counts);
+            if(n == 0)
+            {
+                return 3; // out is too small
+            }
+            
+            in += size;
+            inSize -= size;
+            written += n;
+        }
         
         return 0; // success
     }
     
-    // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is invalid
-    char decode(const char* inpath, const char* outpath)
+    // returns 0 if successful, 3 if out is too small, 4 if in is corrupt
+    char decodeBuffer(const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity, size_t& written)
     {
-        // open inpath in binary mode
-//        ifstream* inputptr = openInput(inpath, true);
-//        if(!inputptr)
-//        {
-//            return 1; // inpath is invalid;
-//        }
-//        ifstream& input = *inputptr;
-//        
-//        input.close();
-//        delete inputptr;
-        return 0; // success
+        written = 0;
+        
+        CodeContext context;
+        bool last = false;
+        while(!last)
+        {
+            BlockHeader header;
+            if(!readBlockHeader(in, inSize, header)
+               || header.payloadSize > inSize - blockHeaderSize)
+            {
+                return 4; // in is corrupt
+            }
+            if(header.rawSize > outCapacity - written)
+            {
+                return 3; // out is too small
+            }
+            
+            if(!decodeBlock(header, in + blockHeaderSize, out + written,
+                            &context))
+            {
+                return 4;
+            }
+            
+            size_t blockSize = blockHeaderSize + header.payloadSize;
+            in += blockSize;
+            inSize -= blockSize;
+            written += header.rawSize;
+            last = header.last;
+        }
+        
+        // there shouldn't be anything after the last block
+        return inSize == 0 ? 0 : 4;
     }
 }
@@ -7,20 +7,119 @@
  * Contains functions to encode and decode files using Huffman coding.
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
+#include <vector>
+
+#include "block.h"
+#include "dictionary.h"
 
 #ifndef HUFFMAN_H
 #define	HUFFMAN_H
 
 namespace huffman
 {
-    // encodes given input file path into given output file path.
+    // encodes given input file path into given output file path, as an
+    // indexed file (blockIndex.h) whose blocks can be decoded in parallel.
+    // Each block holds blockSize bytes of input (at most maxBlockSize), so
+    // a smaller size makes decodeRange's seeks finer at some cost in size.
+    // If checksum is true, each block carries a CRC-32C of its input, which
+    // decoding checks.
     // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is invalid
-    char encode(const char* inpath, const char* outpath);
+    char encode(const char* inpath, const char* outpath,
+                size_t blockSize = defaultBlockSize, bool checksum = false);
     
-    // decodes given input file path into given output file path.
+    // encodes given input file path like encode, as a new frame on the end
+    // of given output file path, which is created if it doesn't exist. An
+    // existing output file should be an indexed file; it then decodes to its
+    // old contents followed by the new ones.
     // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is invalid
-    char decode(const char* inpath, const char* outpath);
+    char encodeAppend(const char* inpath, const char* outpath,
+                      size_t blockSize = defaultBlockSize,
+                      bool checksum = false);
+    
+    // appends the size bytes at data to given output file path, an indexed
+    // file, as a skippable frame that decoding passes over, creating the
+    // file if it doesn't exist.
+    // returns 0 if successful, 1 if size is more than a skippable frame
+    // holds, 2 if outpath is invalid
+    char appendMetadata(const char* outpath, const unsigned char* data,
+                        size_t size);
+    
+    // encodes given input file path into given output file path in the
+    // original single-stream format, for readers that only know that one.
+    // Its codebook only covers ASCII, so the input must hold no byte of 128
+    // or more.
+    // returns 0 if successful, 1 if inpath is invalid or holds a byte of 128
+    // or more, 2 if outpath is invalid
+    char encodeLegacy(const char* inpath, const char* outpath);
+    
+    // decodes given input file path, written by encode or encodeLegacy, into
+    // given output file path, on up to threads threads (one per core if 0).
+    // The blocks of an indexed file are decoded independently; a long legacy
+    // file is cut into segments at the points where speculative decodes
+    // started mid-stream fall into step with the true codeword boundaries.
+    // returns 0 if successful, 1 if inpath is invalid, 2 if outpath is
+    // invalid, 4 if the input file is corrupt, 6 if it's of a newer format
+    // version than this one reads
+    char decode(const char* inpath, const char* outpath,
+                unsigned int threads = 0);
+    
+    // decodes an indexed file written by encode from input into output as
+    // it arrives, a block at a time, so it works on pipes and holds no more
+    // than one block in memory.
+    // returns 0 if successful, 1 if input can't be read, 2 if output can't
+    // be written, 4 if the input is corrupt
+    char decode(std::istream& input, std::ostream& output);
+    
+    // decodes the length bytes of given input file path, an indexed file
+    // written by encode, that start offset bytes into its decoded contents,
+    // into out, which must have room for them. Only the blocks holding part
+    // of the range are read and decoded, found through the file's index.
+    // written is set to the number of bytes written to out, which is short
+    // of length if the range runs past the end of the decoded contents.
+    // returns 0 if successful, 1 if inpath is invalid, 4 if the input file
+    // is corrupt, 5 if it's a legacy file, which can't be seeked in, 6 if
+    // it's of a newer format version
+    char decodeRange(const char* inpath, uint64_t offset, size_t length,
+                     unsigned char* out, size_t& written);
+    
+    // decodes every block of given input file path, an indexed file written
+    // by encode, on up to threads threads (one per core if 0), checking
+    // them against their checksums, without writing the decoded contents
+    // anywhere. Blocks without checksums are only checked to decode.
+    // returns 0 if every block is intact, 1 if inpath is invalid, 4 if the
+    // input file is corrupt, 5 if it's a legacy file, whose single stream
+    // can't be checked a block at a time, 6 if it's of a newer format
+    // version
+    char verify(const char* inpath, unsigned int threads = 0);
+    
+    // trains up to numDicts dictionaries (dictionary.h) from the regular
+    // files in given directory path, each file a sample, into trained, as
+    // trainDictionaries does. The files are read and counted on up to
+    // threads threads (one per core if 0).
+    // returns 0 if successful, 1 if dirpath is invalid or holds no files
+    char train(const char* dirpath, unsigned int numDicts,
+               std::vector<TrainedDictionary>& trained,
+               unsigned int threads = 0);
+    
+    // returns the most bytes encodeBuffer can write for inSize input bytes
+    size_t compressBound(size_t inSize);
+    
+    // encodes the inSize bytes at in into out, which has room for
+    // outCapacity bytes, without touching files or allocating memory.
+    // written is set to the number of bytes written to out.
+    // returns 0 if successful, 3 if out is too small
+    char encodeBuffer(const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity, size_t& written);
+    
+    // decodes the inSize bytes at in, produced by encodeBuffer, into out,
+    // which has room for outCapacity bytes, without touching files or
+    // allocating memory. written is set to the number of bytes written to out.
+    // returns 0 if successful, 3 if out is too small, 4 if in is corrupt
+    char decodeBuffer(const unsigned char* in, size_t inSize,
+                      unsigned char* out, size_t outCapacity, size_t& written);
 }
 
 
@@ -6,8 +6,10 @@
  */
 
 #include <iostream>
+#include <iomanip>
 #include <fstream>
 #include <string>
+#include <vector>
 #include "huffman.h"
 
 using std::cout;
@@ -17,6 +19,35 @@ using std::ofstream;
 using std::ios;
 using std::string;
 
+// the number of dictionaries --train offers
+const unsigned int trainedDictionaries = 4;
+
+// trains dictionaries from the files in dirpath, saving each one next to
+// it as dirpath-n.hufdict and reporting how well it codes its samples.
+// returns 0 if successful, 1 if dirpath is invalid, 2 if a dictionary
+// can't be saved
+char trainDirectory(string dirpath)
+{
+    std::vector<huffman::TrainedDictionary> trained;
+    char errorCode = huffman::train(dirpath.c_str(), trainedDictionaries,
+                                    trained);
+    while(dirpath.length() > 1 && dirpath[dirpath.length() - 1] == '/')
+    {
+        dirpath.erase(dirpath.length() - 1);
+    }
+    
+    for(size_t i = 0; i < trained.size() && errorCode == 0; i++)
+    {
+        string outpath = dirpath + "-" + std::to_string(i + 1) + ".hufdict";
+        errorCode = huffman::saveDictionary(trained[i].dict, outpath.c_str());
+        cout << outpath << ": " << trained[i].numSamples << " samples, "
+             << trained[i].numBytes << " bytes, " << std::fixed
+             << std::setprecision(3) << trained[i].bitsPerByte
+             << " bits per byte\n";
+    }
+    return errorCode;
+}
+
 // returns the extension with dot of a file path,
 // or the empty string if there's no dot or the extension is longer than 3 chars
 inline string getExtension(const string& path)
@@ -35,28 +66,57 @@ inline string getExtension(const string& path)
 
 int main(int argc, char** argv)
 {
+    // an option may come before the file name
+    string option = argc == 3 ? argv[1] : "";
+    bool validOption = option == "" || option == "-c" || option == "-t"
+                       || option == "--train";
+    
     // if incorrect num of args is given, yell at user
-    if(argc != 2)
+    if(argc < 2 || argc > 3 || !validOption)
     {
-        cerr << "huffman must be passed exactly one argument: "
-                "the name of the file to encode or decode.\n";
+        cerr << "huffman must be passed the name of the file to encode "
+                "or decode, or -d to decode standard input to standard "
+                "output.\n"
+                "Put -c before the name to give the encoded blocks "
+                "checksums, or -t to test an encoded file's blocks "
+                "without decoding it anywhere.\n"
+                "Pass --train and a directory of sample files to train "
+                "dictionaries for small objects from them.\n";
         return 1;
     }
-    else // exactly one arg was passed
+    else // the file name is the last arg
     {   
-        string path (argv[1]);
+        string path (argv[argc - 1]);
         char errorCode = 0;
         
-        if(getExtension(path) == ".huf")
+        if(option == "--train")
         {
-            // decode
-            //errorCode = huffman::decode(argv[1], "not yet used");
-            cout << "Decode hasn't been writen yet\n";
+            // cluster the samples and save a dictionary per cluster
+            errorCode = trainDirectory(path);
+        }
+        else if(option == "-t")
+        {
+            // check every block, writing nothing
+            errorCode = huffman::verify(path.c_str());
+        }
+        else if(path == "-d" && option == "")
+        {
+            // decode a pipe as it arrives
+            errorCode = huffman::decode(std::cin, std::cout);
+        }
+        else if(getExtension(path) == ".huf" && option == "")
+        {
+            // decode into the path without the extension
+            string outpath = path.substr(0, path.length() - 4);
+            errorCode = huffman::decode(path.c_str(), outpath.c_str());
         }
         else
         {
             // encode
-            errorCode = huffman::encode(argv[1], path.append(".huf").c_str());
+            string outpath = path + ".huf";
+            errorCode = huffman::encode(path.c_str(), outpath.c_str(),
+                                        huffman::defaultBlockSize,
+                                        option == "-c");
         }
         
         switch(errorCode)
@@ -69,6 +129,17 @@ int main(int argc, char** argv)
             case 2:
                 cerr << "Failed to open output file.\n";
                 break;
+            case 4:
+                cerr << "Input file is corrupt.\n";
+                break;
+            case 5:
+                cerr << "Input file is in the old format, which has no "
+                        "blocks to test.\n";
+                break;
+            case 6:
+                cerr << "Input file was written by a newer version of "
+                        "huffman.\n";
+                break;
             default:
                 cerr << "Unknown error";
                 break;
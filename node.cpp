@@ -8,6 +8,16 @@
 #include "node.h"
 #include <cstddef>
 
+node::node()
+{
+    freq = 0;
+    
+    children[0] = NULL;
+    children[1] = NULL;
+    
+    sym = 0;
+}
+
 // internal node constructor
 node::node(node* leftChild, node* rightChild)
 {
@@ -41,16 +51,3 @@ node::node(const node& orig)
     
     sym = orig.sym;
 }
-
-node::~node()
-{
-    if(children[0])
-    {
-        delete children[0];
-    }
-    
-    if(children[1])
-    {
-        delete children[1];
-    }
-}
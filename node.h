@@ -4,7 +4,8 @@
  *
  * Created on August 11, 2012
  * 
- * Represents a node in our Huffman tree
+ * Represents a node in our Huffman tree. Nodes don't own their children;
+ * a tree's nodes all live in one pool owned by whoever built the tree.
  */
 
 #ifndef NODE_H
@@ -13,6 +14,9 @@
 class node
 {
 public:
+    // constructs an empty leaf, for filling node pools
+    node();
+    
     // internal node constructor.
     node(node* leftChild, node* rightChild);
     
@@ -22,7 +26,7 @@ public:
     // makes copy of orig
     node(const node& orig);
     
-    virtual ~node();
+    node& operator=(const node& orig) = default;
     
     // the symbol contained in this node.
     // only used in leaf nodes.
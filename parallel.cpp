@@ -0,0 +1,63 @@
+/* 
+ * File:   parallel.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace huffman
+{
+    unsigned int defaultThreads()
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 0 ? cores : 1;
+    }
+
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn,
+                     unsigned int threads)
+    {
+        if (threads == 0)
+        {
+            threads = defaultThreads();
+        }
+        if (threads > count)
+        {
+            threads = count;
+        }
+
+        if (threads <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                fn(i);
+            }
+            return;
+        }
+
+        // Items are handed out one at a time, so a slow one doesn't hold up
+        // the others.
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            size_t i;
+            while ((i = next.fetch_add(1)) < count)
+            {
+                fn(i);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threads; t++)
+        {
+            pool.emplace_back(work);
+        }
+        work();
+        for (size_t t = 0; t < pool.size(); t++)
+        {
+            pool[t].join();
+        }
+    }
+}
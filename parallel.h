@@ -0,0 +1,28 @@
+/* 
+ * File:   parallel.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Spreads independent pieces of work over the CPU's cores.
+ */
+
+#ifndef PARALLEL_H
+#define	PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+namespace huffman
+{
+    // Returns the number of worker threads parallelFor uses by default: one
+    // per core
+    unsigned int defaultThreads();
+
+    // Calls fn(i) for every i below count on a pool of up to threads worker
+    // threads (defaultThreads() if 0), each taking the next i as soon as it
+    // finishes the last. Returns once every call has returned. With a single
+    // thread or item, fn runs on the calling thread.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn,
+                     unsigned int threads = 0);
+}
+
+#endif	/* PARALLEL_H */
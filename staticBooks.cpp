@@ -0,0 +1,141 @@
+/* 
+ * File:   staticBooks.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "staticBooks.h"
+
+namespace huffman
+{
+    namespace
+    {
+        // the number of bytes chooseStaticBook looks at
+        const size_t sampleSize = 128;
+
+        /*
+        Codeword lengths of each static codebook, in symbol order. They're
+        Huffman codes of byte counts from sample corpora (English licence
+        texts, a mix of JSON documents, and the leading bytes of a few
+        hundred executables), scaled to a total of 16384 with every byte
+        counted at least once so that any input can be coded.
+        */
+        const unsigned char bookLengths[numStaticBooks][numSymbols] = {
+        { // bookText
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14,  6, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+             3, 14,  8, 14, 14, 14, 14, 11,  9,  9, 14, 14,  7, 10,  7, 11,
+            11, 11, 11, 12, 13, 13, 12, 12, 14, 13, 11, 11, 12, 14, 12, 14,
+            14,  8, 11,  9,  9,  8, 10,  9, 10,  8, 14, 13,  8, 10,  8,  8,
+             9, 14,  8,  8,  8,  9, 12,  9, 14,  9, 14, 14, 14, 14, 14, 14,
+            14,  4,  7,  5,  5,  4,  6,  6,  5,  4, 10,  8,  5,  6,  4,  4,
+             6, 10,  4,  4,  4,  5,  7,  7,  9,  6, 12, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 13, 13, 13
+        },
+        { // bookJson
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14,  4, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+             2, 14,  3, 11, 12, 10, 14, 14, 11, 11, 14, 13,  4, 10,  8,  7,
+             8,  7,  9,  9,  9, 10,  9, 10,  9,  9,  5, 14, 14, 13, 14, 11,
+            12,  6,  6,  5, 12, 12, 11, 14, 14, 13, 14, 14, 14, 13, 14, 13,
+            13, 14, 14, 14, 12, 14, 14, 14, 14, 14, 14,  6, 10,  6, 14,  7,
+            13,  5,  5,  5,  7,  5,  8,  7,  7,  6, 11, 10,  7,  7,  6,  6,
+             7, 10,  6,  6,  5,  7,  9,  9,  9,  9, 12,  8, 14,  8, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+            14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 13
+        },
+        { // bookBinary
+             1,  7,  8,  8,  8,  9,  9,  8,  8,  9,  7, 11, 11, 10, 11,  7,
+             9, 10,  8, 11, 11, 10, 12, 11, 10, 11, 11, 11, 11, 11, 12,  9,
+             5, 11,  9,  9,  7,  8, 11,  9,  8,  9, 11, 11,  9,  8,  8,  9,
+             9,  8, 10, 10, 10,  9, 11, 11, 10, 10,  9,  9, 10,  8, 10, 11,
+             9,  8, 10,  9,  8,  8, 10, 10,  6,  8, 11, 11,  8,  9,  9, 10,
+             9, 11,  9,  9,  9, 10, 11, 11, 10, 11, 11, 10, 10, 10, 11,  7,
+            10,  7,  8,  7,  7,  6,  7,  8,  7,  6, 11,  9,  7,  8,  7,  7,
+             8, 11,  7,  7,  6,  7,  9,  9,  9,  9, 11, 10, 10,  9, 11, 11,
+             9, 11, 12,  9,  9,  9, 12, 12, 11,  7, 12,  8, 12,  8, 12, 12,
+            10, 12, 12, 12, 11, 12, 12, 13, 11, 12, 12, 13, 12, 12, 12, 12,
+            10, 12, 12, 13, 13, 13, 13, 13, 11, 12, 12, 13, 12, 12, 12, 12,
+            11, 13, 12, 13, 12, 12, 10, 13, 11, 12,  9, 12, 12, 12, 10, 10,
+             8, 10, 10, 10, 11, 11, 10, 10, 11, 11, 12, 12, 12, 12, 12, 12,
+            10, 11, 11, 12, 12, 12, 12, 13, 11, 11, 11, 11, 12, 12, 11, 11,
+            10, 12, 11, 12, 12, 11, 11, 11,  8,  8, 11, 10, 11, 11, 11, 10,
+            10, 11, 11, 11, 11, 11, 10, 10, 10, 11, 10, 10, 10, 10, 10,  6
+        }
+        };
+
+        struct Books
+        {
+            Books()
+            {
+                for (unsigned int id = 0; id < numStaticBooks; id++)
+                {
+                    buildCanonicalCode(bookLengths[id], numSymbols,
+                                       codes[id]);
+                    buildCodeTable(codes[id], tables[id]);
+                    buildDecodeTable(codes[id], decodeTables[id]);
+                }
+            }
+
+            CanonicalCode codes[numStaticBooks];
+            CodeTable tables[numStaticBooks];
+            DecodeTable decodeTables[numStaticBooks];
+        };
+
+        // Builds the books on first use
+        const Books& books()
+        {
+            static const Books built;
+            return built;
+        }
+    }
+
+    const CodeTable& staticCodeTable(unsigned int id)
+    {
+        return books().tables[id];
+    }
+
+    const CanonicalCode& staticCanonicalCode(unsigned int id)
+    {
+        return books().codes[id];
+    }
+
+    const DecodeTable& staticDecodeTable(unsigned int id)
+    {
+        return books().decodeTables[id];
+    }
+
+    unsigned int chooseStaticBook(const unsigned char* data, size_t size)
+    {
+        size_t n = size < sampleSize ? size : sampleSize;
+
+        unsigned int best = 0;
+        size_t bestBits = (size_t)-1;
+        for (unsigned int id = 0; id < numStaticBooks; id++)
+        {
+            size_t bits = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                bits += bookLengths[id][data[i]];
+            }
+            if (bits < bestBits)
+            {
+                best = id;
+                bestBits = bits;
+            }
+        }
+        return best;
+    }
+}
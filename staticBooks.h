@@ -0,0 +1,45 @@
+/* 
+ * File:   staticBooks.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Canonical codebooks compiled into the library, so that small inputs can be
+ * encoded without counting symbols or storing a codebook.
+ */
+
+#ifndef STATICBOOKS_H
+#define	STATICBOOKS_H
+
+#include <cstddef>
+
+#include "codebook.h"
+#include "decoder.h"
+
+namespace huffman
+{
+    // The ids of the static codebooks, as stored in encoded blocks
+    enum StaticBook
+    {
+        bookText,
+        bookJson,
+        bookBinary,
+        numStaticBooks
+    };
+
+    // Blocks shorter than this many bytes are encoded with a static codebook,
+    // since counting symbols and storing a codebook would cost more than a
+    // tailored code saves.
+    const size_t staticBookThreshold = 512;
+
+    // Returns the codebook with the given id, which is below numStaticBooks.
+    // Every symbol has a codeword in every static codebook.
+    const CodeTable& staticCodeTable(unsigned int id);
+    const CanonicalCode& staticCanonicalCode(unsigned int id);
+    const DecodeTable& staticDecodeTable(unsigned int id);
+
+    // Returns the id of the static codebook that codes a sample from the
+    // start of the size bytes at data in the fewest bits
+    unsigned int chooseStaticBook(const unsigned char* data, size_t size);
+}
+
+#endif	/* STATICBOOKS_H */
+
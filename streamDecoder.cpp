@@ -0,0 +1,207 @@
+/* 
+ * File:   streamDecoder.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "streamDecoder.h"
+
+#include <cstring>
+
+namespace huffman
+{
+    StreamDecoder::StreamDecoder(Sink sink)
+        : sink(sink),
+          stage(stageFrame),
+          haveHeader(false),
+          numBlocks(0),
+          decodedSize(0),
+          frameSize(0),
+          numFrames(0),
+          indexLeft(0),
+          skipLeft(0)
+    {
+        memset(&frame, 0, sizeof(frame));
+        memset(trailer, 0, sizeof(trailer));
+        pending.reserve(blockBound(maxBlockSize));
+    }
+
+    bool StreamDecoder::push(const unsigned char* data, size_t size)
+    {
+        while (stage != stageFailed)
+        {
+            if (stage == stageFrame)
+            {
+                // the header's length depends on its version, so it's
+                // taken a byte at a time
+                FrameHeader next;
+                FrameStatus status = readFrameHeader(pending.data(),
+                                                     pending.size(), next);
+                if (status == frameShort)
+                {
+                    if (!fill(data, size, pending.size() + 1))
+                    {
+                        return true;
+                    }
+                    continue;
+                }
+                if (status == frameSkippable)
+                {
+                    pending.clear();
+                    skipLeft = next.contentSize;
+                    stage = stageSkip;
+                    continue;
+                }
+                if (status != frameOk)
+                {
+                    stage = stageFailed;
+                    break;
+                }
+                frame = next;
+                frameSize = frame.size;
+                pending.clear();
+                stage = stageBlocks;
+            }
+            else if (stage == stageBlocks)
+            {
+                if (!haveHeader)
+                {
+                    if (!fill(data, size, blockHeaderSize))
+                    {
+                        return true;
+                    }
+                    if (!readBlockHeader(pending.data(), pending.size(),
+                                         header)
+                        || header.payloadSize
+                           > blockBound(maxBlockSize) - blockHeaderSize)
+                    {
+                        stage = stageFailed;
+                        break;
+                    }
+                    haveHeader = true;
+                }
+
+                // a block that decodes to nothing may have no payload to
+                // wait for
+                if (!fill(data, size, blockHeaderSize + header.payloadSize))
+                {
+                    return true;
+                }
+                if (!emitBlock(pending.data() + blockHeaderSize))
+                {
+                    stage = stageFailed;
+                    break;
+                }
+                pending.clear();
+                haveHeader = false;
+                numBlocks++;
+                frameSize += blockHeaderSize + header.payloadSize;
+
+                if (header.last)
+                {
+                    stage = stageIndex;
+                    indexLeft = numBlocks * indexEntrySize + indexTrailerSize;
+                }
+            }
+            else if (stage == stageSkip)
+            {
+                size_t n = size < skipLeft ? size : skipLeft;
+                data += n;
+                size -= n;
+                skipLeft -= n;
+                if (skipLeft > 0)
+                {
+                    return true;
+                }
+                numFrames++;
+                stage = stageFrame;
+            }
+            else
+            {
+                // only the trailer is kept
+                size_t n = size < indexLeft ? size : indexLeft;
+                for (size_t k = 0; k < n; k++)
+                {
+                    uint64_t fromEnd = indexLeft - k;
+                    if (fromEnd <= indexTrailerSize)
+                    {
+                        trailer[indexTrailerSize - fromEnd] = data[k];
+                    }
+                }
+                data += n;
+                size -= n;
+                indexLeft -= n;
+                if (indexLeft > 0)
+                {
+                    return true;
+                }
+                if (!endFrame())
+                {
+                    stage = stageFailed;
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool StreamDecoder::finish()
+    {
+        if (stage != stageFrame || !pending.empty() || numFrames == 0)
+        {
+            stage = stageFailed;
+            return false;
+        }
+        return true;
+    }
+
+    bool StreamDecoder::getContentSize(uint64_t& size)
+    {
+        if (stage == stageFailed || !(frame.flags & frameContentSize))
+        {
+            return false;
+        }
+        size = frame.contentSize;
+        return true;
+    }
+
+    bool StreamDecoder::endFrame()
+    {
+        if (((frame.flags & frameContentSize)
+             && decodedSize != frame.contentSize)
+            || ((frame.flags & frameLength)
+                && frameSize + numBlocks * indexEntrySize + indexTrailerSize
+                   != frame.length)
+            || getLE64(trailer) != numBlocks
+            || memcmp(trailer + 8, indexMagic, sizeof(indexMagic)) != 0)
+        {
+            return false;
+        }
+
+        // the next frame is encoded on its own
+        context = CodeContext();
+        numBlocks = 0;
+        decodedSize = 0;
+        numFrames++;
+        stage = stageFrame;
+        return true;
+    }
+
+    bool StreamDecoder::fill(const unsigned char*& data, size_t& size,
+                             size_t want)
+    {
+        size_t n = want - pending.size();
+        n = n < size ? n : size;
+        pending.insert(pending.end(), data, data + n);
+        data += n;
+        size -= n;
+        return pending.size() == want;
+    }
+
+    bool StreamDecoder::emitBlock(const unsigned char* in)
+    {
+        decoded.resize(header.rawSize);
+        decodedSize += header.rawSize;
+        return decodeBlock(header, in, decoded.data(), &context)
+               && sink(decoded.data(), decoded.size());
+    }
+}
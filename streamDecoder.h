@@ -0,0 +1,119 @@
+/* 
+ * File:   streamDecoder.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Incremental decoder for indexed files that arrive in pieces.
+ */
+
+#ifndef STREAMDECODER_H
+#define	STREAMDECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "block.h"
+#include "blockIndex.h"
+
+namespace huffman
+{
+    /*
+    Decodes an indexed file (blockIndex.h) that arrives in pieces of any
+    size, such as reads from a pipe. Input is buffered until a whole block
+    has arrived, then that block is decoded and its output handed to the
+    sink, so memory use is bounded by one encoded and one decoded block no
+    matter how long the file is. The index isn't needed to decode a stream
+    read from the start, so it's only checked to have the right length and
+    trailer. The frames of a file decode one after another, and skippable
+    frames are passed over.
+    */
+    class StreamDecoder {
+    public:
+        // Receives each decoded block. Returns false to report a failure,
+        // which makes push fail.
+        typedef std::function<bool(const unsigned char* data, size_t size)>
+            Sink;
+
+        StreamDecoder(Sink sink);
+
+        StreamDecoder(const StreamDecoder&) = delete;
+        StreamDecoder& operator=(const StreamDecoder&) = delete;
+
+        StreamDecoder(StreamDecoder&&) = delete;
+        StreamDecoder& operator=(StreamDecoder&&) = delete;
+
+        // Adds size bytes of the encoded file, decoding every block that's
+        // complete. Returns true if successful; fails, and keeps failing, if
+        // the input is corrupt or the sink fails.
+        bool push(const unsigned char* data, size_t size);
+
+        // Ends the input. Returns true if it held a whole file, ending with
+        // a whole frame.
+        bool finish();
+
+        // true if push or finish has failed
+        bool isFailed() { return stage == stageFailed; }
+
+        // Sets size to the number of bytes the frame being decoded, or the
+        // last one, decodes to, once its header has arrived, so a sink can
+        // make room for them.
+        // Returns false if the size isn't known.
+        bool getContentSize(uint64_t& size);
+
+    private:
+        enum Stage
+        {
+            stageFrame,  // reading the frame header
+            stageBlocks, // reading blocks
+            stageIndex,  // reading the index after the last block
+            stageSkip,   // passing over a skippable frame
+            stageFailed
+        };
+
+        // Moves up to want - pending.size() bytes from data to pending.
+        // Returns true if pending then holds want bytes.
+        bool fill(const unsigned char*& data, size_t& size, size_t want);
+
+        // Checks the frame whose index has just been read, and readies the
+        // decoder for the next. Returns false if the frame is corrupt.
+        bool endFrame();
+
+        // Decodes the block at in, whose header has been read, and passes
+        // its output to the sink. Returns false on failure.
+        bool emitBlock(const unsigned char* in);
+
+        Sink sink;
+        Stage stage;
+
+        // the header of the block being read, if pending holds it
+        BlockHeader header;
+        bool haveHeader;
+
+        FrameHeader frame;
+        uint64_t numBlocks;
+        uint64_t decodedSize;
+        uint64_t frameSize; // the bytes of the frame read so far
+        uint64_t numFrames; // the frames read whole, skippable or not
+
+        // The code later blocks can repeat
+        CodeContext context;
+
+        // the bytes of the index still to come, and the trailer's last
+        // bytes seen
+        uint64_t indexLeft;
+        unsigned char trailer[indexTrailerSize];
+
+        // the bytes of a skippable frame's metadata still to come
+        uint64_t skipLeft;
+
+        // Input that hasn't made up a whole frame header, block header or
+        // block yet
+        std::vector<unsigned char> pending;
+
+        // Holds each decoded block until the sink takes it
+        std::vector<unsigned char> decoded;
+    };
+}
+
+#endif	/* STREAMDECODER_H */
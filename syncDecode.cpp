@@ -0,0 +1,114 @@
+/* 
+ * File:   syncDecode.cpp
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ */
+
+#include "syncDecode.h"
+#include "parallel.h"
+
+namespace huffman
+{
+    namespace
+    {
+        // One run's speculative walk
+        struct Walk
+        {
+            std::vector<uint64_t> marks; // codeword starts, from the run's
+            size_t end;                  // first codeword start past the run
+            bool valid;                  // false if it met a bad codeword
+        };
+
+        bool marked(const Walk& walk, size_t i)
+        {
+            return walk.marks[i >> 6] >> (i & 63) & 1;
+        }
+
+        // Returns the number of bits of walk.marks from from up to to
+        size_t countMarks(const Walk& walk, size_t from, size_t to)
+        {
+            size_t count = 0;
+            while (from < to && (from & 63) != 0)
+            {
+                count += marked(walk, from++);
+            }
+            for (; from + 64 <= to; from += 64)
+            {
+                count += __builtin_popcountll(walk.marks[from >> 6]);
+            }
+            while (from < to)
+            {
+                count += marked(walk, from++);
+            }
+            return count;
+        }
+    }
+
+    bool planSegments(const DecodeTable& table, const unsigned char* data,
+                      size_t size, size_t startBit, size_t endBit,
+                      unsigned int numSegments, SegmentPlan& plan)
+    {
+        if (numSegments == 0)
+        {
+            numSegments = 1;
+        }
+
+        // the runs the stream is cut into
+        std::vector<size_t> runStarts(numSegments + 1);
+        for (unsigned int k = 0; k <= numSegments; k++)
+        {
+            runStarts[k] = startBit + (endBit - startBit) * k / numSegments;
+        }
+
+        // walk every run from its first bit at once
+        std::vector<Walk> walks(numSegments);
+        parallelFor(numSegments, [&](size_t k)
+        {
+            Walk& walk = walks[k];
+            size_t runBits = runStarts[k + 1] - runStarts[k];
+            walk.marks.assign((runBits + 63) / 64, 0);
+            walk.end = runStarts[k];
+            walk.valid = markCodewords(table, data, size, walk.end,
+                                       runStarts[k + 1], walk.marks.data());
+        }, numSegments);
+
+        // then follow the true path from run to run
+        plan.starts.assign(numSegments + 1, startBit);
+        plan.outOffsets.assign(numSegments + 1, 0);
+        for (unsigned int k = 0; k < numSegments; k++)
+        {
+            const Walk& walk = walks[k];
+            size_t runStart = runStarts[k];
+            size_t runEnd = runStarts[k + 1];
+            size_t pos = plan.starts[k];
+            uint64_t count = 0;
+
+            // step by hand until the true path meets the run's walk
+            while (pos < runEnd && !marked(walk, pos - runStart))
+            {
+                unsigned int len = codewordLength(table, data, size, pos);
+                if (len == 0)
+                {
+                    return false;
+                }
+                pos += len;
+                count++;
+            }
+
+            // from there on the walk is the true path
+            if (pos < runEnd)
+            {
+                if (!walk.valid)
+                {
+                    return false;
+                }
+                count += countMarks(walk, pos - runStart, runEnd - runStart);
+                pos = walk.end;
+            }
+
+            plan.starts[k + 1] = pos;
+            plan.outOffsets[k + 1] = plan.outOffsets[k] + count;
+        }
+
+        return plan.starts[numSegments] == endBit;
+    }
+}
@@ -0,0 +1,50 @@
+/* 
+ * File:   syncDecode.h
+ * Author: Alexander Schurman, alexander.schurman@gmail.com
+ *
+ * Splits a single stream of codewords into segments that can be decoded in
+ * parallel, even though nothing records where its codewords start.
+ */
+
+#ifndef SYNCDECODE_H
+#define	SYNCDECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "decoder.h"
+
+namespace huffman
+{
+    // Segment k's codewords start at bit starts[k] and end at starts[k + 1],
+    // and decode to output bytes outOffsets[k] to outOffsets[k + 1].
+    struct SegmentPlan
+    {
+        std::vector<size_t> starts;
+        std::vector<uint64_t> outOffsets;
+    };
+
+    /*
+    Plans numSegments segments of the codewords from bit startBit to endBit
+    of the size bytes at data.
+
+    The stream is cut into equal runs of bits, and each run is walked on its
+    own thread from its first bit, as if a codeword started there, marking
+    every position where one of its codewords starts. A Huffman code tends
+    to fall back into step with the true codeword boundaries within a few
+    codewords, so once the true path (known from the start of the stream)
+    reaches a position marked by the next run's walk, the two coincide from
+    there on. Stitching the runs together at those points finds where each
+    segment really starts and how many symbols it holds, walking by hand
+    only the few codewords before each sync point.
+
+    Returns false if the stream holds an invalid codeword or doesn't end
+    exactly at endBit.
+    */
+    bool planSegments(const DecodeTable& table, const unsigned char* data,
+                      size_t size, size_t startBit, size_t endBit,
+                      unsigned int numSegments, SegmentPlan& plan);
+}
+
+#endif	/* SYNCDECODE_H */
@@ -0,0 +1,404 @@
+/*
+File: bitPackTest.cpp
+Author: Alexander Schurman, alexander.schurman@gmail.com
+
+Provides tests for the codeword packing kernels defined in bitPack.h, the
+decoding kernels defined in decoder.h and fsmDecoder.h, and the checksum
+kernels defined in checksum.h
+*/
+
+#include "catch.hpp"
+#include "../bitPack.h"
+#include "../checksum.h"
+#include "../codebook.h"
+#include "../decoder.h"
+#include "../dispatch.h"
+#include "../fsmDecoder.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using huffman::CodeTable;
+using huffman::PackState;
+
+// Packs data with table using the given kernel and returns the packed bytes
+template <typename Pack>
+std::vector<unsigned char> packAll(Pack pack, const CodeTable& table,
+                                   const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> out(huffman::packBound(table, data.size()));
+    PackState state = {0, 0};
+    size_t n = pack(table, data.data(), data.size(), state, out.data());
+    n += huffman::flushBits(state, out.data() + n);
+    out.resize(n);
+    return out;
+}
+
+TEST_CASE("packing bits MSB-first", "[bitpack]")
+{
+    unsigned char out[16] = {0};
+    PackState state = {0, 0};
+    size_t n = 0;
+
+    n += huffman::putBits(state, 0x5, 3, out + n);     // 101
+    REQUIRE(n == 0);
+    REQUIRE(state.bits == 3);
+    n += huffman::putBits(state, 0x1F0, 9, out + n);   // 1 1111 0000
+    REQUIRE(n == 1);
+    REQUIRE(out[0] == 0xBF);
+    n += huffman::flushBits(state, out + n);
+    REQUIRE(n == 2);
+    REQUIRE(out[1] == 0x00);
+    REQUIRE(state.bits == 0);
+}
+
+TEST_CASE("codebook is canonical", "[bitpack][codebook]")
+{
+    // Frequencies 4, 2, 1, 1 give lengths 1, 2, 3, 3
+    uint64_t counts[huffman::numSymbols] = {0};
+    counts['a'] = 4;
+    counts['b'] = 2;
+    counts['c'] = 1;
+    counts['d'] = 1;
+
+    CodeTable table;
+    huffman::buildCodeTable(counts, table);
+    REQUIRE(table.maxBits == 3);
+    REQUIRE(table.lens['a'] == 1);
+    REQUIRE(table.codes['a'] == 0x0);
+    REQUIRE(table.lens['b'] == 2);
+    REQUIRE(table.codes['b'] == 0x2);
+    REQUIRE(table.lens['c'] == 3);
+    REQUIRE(table.codes['c'] == 0x6);
+    REQUIRE(table.lens['d'] == 3);
+    REQUIRE(table.codes['d'] == 0x7);
+    REQUIRE(table.lens['e'] == 0);
+
+    std::vector<unsigned char> data {'a', 'b', 'c', 'd', 'a'};
+    std::vector<unsigned char> packed =
+        packAll(huffman::packCodesScalar, table, data);
+    // 0 10 110 111 0 -> 0101 1011 10(00 0000)
+    REQUIRE(packed.size() == 2);
+    REQUIRE(packed[0] == 0x5B);
+    REQUIRE(packed[1] == 0x80);
+}
+
+TEST_CASE("all kernel levels give identical results", "[bitpack][long]")
+{
+    // Skew the distribution by different amounts to get codebooks whose
+    // longest code takes each of the kernel's paths.
+    for (int skew = 1; skew <= 40; skew *= 3)
+    {
+        std::vector<unsigned char> data(10007);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            int r = rand() % 256;
+            for (int s = 1; s < skew && r > 0; s++)
+            {
+                r = rand() % r;
+            }
+            data[i] = r;
+        }
+
+        uint64_t counts[huffman::numSymbols] = {0};
+        huffman::countChars(data.data(), data.size(), counts);
+        CodeTable table;
+        huffman::buildCodeTable(counts, table);
+
+        std::vector<unsigned char> scalarPacked =
+            packAll(huffman::packCodesScalar, table, data);
+
+        for (int l = 0; l < huffman::numKernelLevels; l++)
+        {
+            const huffman::Kernels* k =
+                huffman::kernelsFor((huffman::KernelLevel)l);
+            if (!k)
+            {
+                continue;
+            }
+
+            INFO("kernels: " << k->name << ", skew: " << skew
+                 << ", longest code: " << table.maxBits);
+            uint64_t levelCounts[huffman::numSymbols] = {0};
+            k->countChars(data.data(), data.size(), levelCounts);
+            REQUIRE(std::equal(counts, counts + huffman::numSymbols,
+                               levelCounts));
+            REQUIRE(packAll(k->packCodes, table, data) == scalarPacked);
+        }
+    }
+}
+
+TEST_CASE("checksums agree at every kernel level", "[checksum]")
+{
+    const char* check = "123456789";
+    REQUIRE(huffman::crc32cScalar((const unsigned char*)check, 9, 0)
+            == 0xE3069283);
+
+    // lengths around the 8-byte words, counted on from a running checksum
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = rand();
+    }
+    for (size_t size : {0, 1, 7, 8, 9, 63, 997})
+    {
+        uint32_t head = huffman::crc32cScalar(data.data(), 3, 0);
+        uint32_t expected = huffman::crc32cScalar(data.data(), size + 3, 0);
+        uint64_t expectedCounts[huffman::numSymbols] = {0};
+        huffman::countChars(data.data() + 3, size, expectedCounts);
+
+        for (int l = 0; l < huffman::numKernelLevels; l++)
+        {
+            const huffman::Kernels* k =
+                huffman::kernelsFor((huffman::KernelLevel)l);
+            if (!k)
+            {
+                continue;
+            }
+
+            INFO("kernels: " << k->name << ", size: " << size);
+            REQUIRE(k->crc32c(data.data() + 3, size, head) == expected);
+            uint32_t crc = head;
+            uint64_t counts[huffman::numSymbols] = {0};
+            k->countCharsCrc(data.data() + 3, size, counts, crc);
+            REQUIRE(crc == expected);
+            REQUIRE(std::equal(counts, counts + huffman::numSymbols,
+                               expectedCounts));
+        }
+    }
+}
+
+TEST_CASE("decode tables work at every kernel level", "[decode]")
+{
+    // Skewed data gets short codes with a long tail, which mixes entries of
+    // several symbols with codewords longer than either table
+    for (int skew = 1; skew <= 40; skew *= 3)
+    {
+        std::vector<unsigned char> data(10007);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            int r = rand() % 256;
+            for (int s = 1; s < skew && r > 0; s++)
+            {
+                r = rand() % r;
+            }
+            data[i] = r;
+        }
+
+        uint64_t counts[huffman::numSymbols] = {0};
+        huffman::countChars(data.data(), data.size(), counts);
+        CodeTable table;
+        huffman::buildCodeTable(counts, table);
+        std::vector<unsigned char> packed =
+            packAll(huffman::packCodesScalar, table, data);
+
+        unsigned char lengths[huffman::numSymbols];
+        std::copy(table.lens, table.lens + huffman::numSymbols, lengths);
+        huffman::CanonicalCode code;
+        REQUIRE(huffman::buildCanonicalCode(lengths, huffman::numSymbols,
+                                            code));
+        huffman::DecodeTable* single = new huffman::DecodeTable();
+        REQUIRE(huffman::buildDecodeTable(code, *single));
+        huffman::MultiDecodeTable* multi = new huffman::MultiDecodeTable();
+        huffman::buildMultiDecodeTable(code, *multi);
+
+        for (int l = 0; l < huffman::numKernelLevels; l++)
+        {
+            const huffman::Kernels* k =
+                huffman::kernelsFor((huffman::KernelLevel)l);
+            if (!k)
+            {
+                continue;
+            }
+
+            INFO("kernels: " << k->name << ", skew: " << skew
+                 << ", longest code: " << table.maxBits);
+            std::vector<unsigned char> decoded(data.size());
+            size_t bitPos = 0;
+            size_t n = k->decodeSymbols(*single, packed.data(), packed.size(),
+                                        bitPos, packed.size() * 8,
+                                        decoded.data(), decoded.size());
+            REQUIRE(n == data.size());
+            REQUIRE(decoded == data);
+
+            std::fill(decoded.begin(), decoded.end(), 0);
+            bitPos = 0;
+            n = k->decodeMultiSymbols(*multi, packed.data(), packed.size(),
+                                      bitPos, packed.size() * 8,
+                                      decoded.data(), decoded.size());
+            REQUIRE(n == data.size());
+            REQUIRE(decoded == data);
+
+            // a few symbols at a time, resuming where the last call stopped
+            std::fill(decoded.begin(), decoded.end(), 0);
+            bitPos = 0;
+            n = 0;
+            while (n < data.size())
+            {
+                size_t want = std::min<size_t>(7, data.size() - n);
+                REQUIRE(k->decodeMultiSymbols(*multi, packed.data(),
+                                              packed.size(), bitPos,
+                                              packed.size() * 8,
+                                              decoded.data() + n, want)
+                        == want);
+                n += want;
+            }
+            REQUIRE(decoded == data);
+        }
+        delete multi;
+        delete single;
+    }
+}
+
+TEST_CASE("interleaved streams decode at every kernel level", "[decode]")
+{
+    // short codes take the lockstep loop; the long tail of heavier skews
+    // leaves everything to the epilogue
+    for (int skew = 1; skew <= 40; skew *= 3)
+    {
+        std::vector<unsigned char> data(10007);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            int r = rand() % 256;
+            for (int s = 1; s < skew && r > 0; s++)
+            {
+                r = rand() % r;
+            }
+            data[i] = r;
+        }
+
+        uint64_t counts[huffman::numSymbols] = {0};
+        huffman::countChars(data.data(), data.size(), counts);
+        CodeTable table;
+        huffman::buildCodeTable(counts, table);
+
+        std::vector<unsigned char> streams[huffman::numStreams];
+        const unsigned char* streamData[huffman::numStreams];
+        size_t streamSizes[huffman::numStreams];
+        for (unsigned int s = 0; s < huffman::numStreams; s++)
+        {
+            std::vector<unsigned char> dealt;
+            for (size_t i = s; i < data.size(); i += huffman::numStreams)
+            {
+                dealt.push_back(data[i]);
+            }
+            streams[s] = packAll(huffman::packCodesScalar, table, dealt);
+            streamData[s] = streams[s].data();
+            streamSizes[s] = streams[s].size();
+        }
+
+        unsigned char lengths[huffman::numSymbols];
+        std::copy(table.lens, table.lens + huffman::numSymbols, lengths);
+        huffman::CanonicalCode code;
+        REQUIRE(huffman::buildCanonicalCode(lengths, huffman::numSymbols,
+                                            code));
+        huffman::DecodeTable* decodeTable = new huffman::DecodeTable();
+        REQUIRE(huffman::buildDecodeTable(code, *decodeTable));
+
+        for (int l = 0; l < huffman::numKernelLevels; l++)
+        {
+            const huffman::Kernels* k =
+                huffman::kernelsFor((huffman::KernelLevel)l);
+            if (!k)
+            {
+                continue;
+            }
+
+            INFO("kernels: " << k->name << ", skew: " << skew
+                 << ", longest code: " << table.maxBits);
+            std::vector<unsigned char> decoded(data.size());
+            REQUIRE(k->decodeInterleaved(*decodeTable, streamData,
+                                         streamSizes, decoded.data(),
+                                         decoded.size()));
+            REQUIRE(decoded == data);
+
+            // a stream that's cut short
+            streamSizes[2] -= 2;
+            REQUIRE(!k->decodeInterleaved(*decodeTable, streamData,
+                                          streamSizes, decoded.data(),
+                                          decoded.size()));
+            streamSizes[2] += 2;
+        }
+        delete decodeTable;
+    }
+}
+
+TEST_CASE("the state machine decodes like the lookup table", "[decode][fsm]")
+{
+    for (int skew = 1; skew <= 40; skew *= 3)
+    {
+        std::vector<unsigned char> data(5003);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            int r = rand() % 256;
+            for (int s = 1; s < skew && r > 0; s++)
+            {
+                r = rand() % r;
+            }
+            data[i] = r;
+        }
+
+        uint64_t counts[huffman::numSymbols] = {0};
+        huffman::countChars(data.data(), data.size(), counts);
+        CodeTable table;
+        huffman::buildCodeTable(counts, table);
+        std::vector<unsigned char> packed =
+            packAll(huffman::packCodesScalar, table, data);
+
+        unsigned char lengths[huffman::numSymbols];
+        std::copy(table.lens, table.lens + huffman::numSymbols, lengths);
+        huffman::CanonicalCode code;
+        REQUIRE(huffman::buildCanonicalCode(lengths, huffman::numSymbols,
+                                            code));
+        huffman::FsmDecodeTable* fsm = new huffman::FsmDecodeTable();
+        REQUIRE(huffman::buildFsmDecodeTable(code, *fsm));
+
+        INFO("skew: " << skew << ", longest code: " << table.maxBits);
+        std::vector<unsigned char> decoded(data.size());
+        size_t bitPos = 0;
+        REQUIRE(huffman::decodeFsmSymbols(*fsm, packed.data(), packed.size(),
+                                          bitPos, packed.size() * 8,
+                                          decoded.data(), decoded.size())
+                == data.size());
+        REQUIRE(decoded == data);
+        REQUIRE(bitPos <= packed.size() * 8);
+        REQUIRE(bitPos + 8 > packed.size() * 8);
+
+        // from an unaligned codeword, in small pieces, stopping where each
+        // piece ends
+        size_t skip = 3;
+        bitPos = 0;
+        for (size_t i = 0; i < skip; i++)
+        {
+            bitPos += table.lens[data[i]];
+        }
+        size_t n = skip;
+        while (n < data.size())
+        {
+            size_t want = std::min<size_t>(13, data.size() - n);
+            size_t got = huffman::decodeFsmSymbols(*fsm, packed.data(),
+                                                   packed.size(), bitPos,
+                                                   packed.size() * 8,
+                                                   decoded.data() + n, want);
+            REQUIRE(got == want);
+            n += got;
+        }
+        REQUIRE(decoded == data);
+        delete fsm;
+    }
+
+    // a lone codeword "0" leaves "1" invalid, and decoding stops at it
+    unsigned char lengths[huffman::numSymbols] = {0};
+    lengths['x'] = 1;
+    huffman::CanonicalCode code;
+    REQUIRE(huffman::buildCanonicalCode(lengths, huffman::numSymbols, code));
+    huffman::FsmDecodeTable* fsm = new huffman::FsmDecodeTable();
+    REQUIRE(huffman::buildFsmDecodeTable(code, *fsm));
+    unsigned char bad[3] = {0x00, 0x02, 0x00}; // bit 14 is set
+    unsigned char decoded[24];
+    size_t bitPos = 0;
+    REQUIRE(huffman::decodeFsmSymbols(*fsm, bad, 3, bitPos, 24, decoded, 24)
+            == 14);
+    REQUIRE(bitPos == 14);
+    delete fsm;
+}
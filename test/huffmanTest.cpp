@@ -0,0 +1,1591 @@
+/*
+File: huffmanTest.cpp
+Author: Alexander Schurman, alexander.schurman@gmail.com
+
+Provides tests for the encoders and decoders
+*/
+
+#include "catch.hpp"
+#include "../bitPack.h"
+#include "../block.h"
+#include "../blockIndex.h"
+#include "../blockSplit.h"
+#include "../codebook.h"
+#include "../dictionary.h"
+#include "../encoder.h"
+#include "../huffman.h"
+#include "../parallel.h"
+#include "../staticBooks.h"
+#include "../streamDecoder.h"
+#include <string>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <cstdlib>
+#include <vector>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Returns size bytes of text-like data
+std::vector<unsigned char> sampleData(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        int r = rand() % 64;
+        data[i] = r < 16 ? ' ' : 'a' + r % 26;
+    }
+    return data;
+}
+
+TEST_CASE("streaming encoder emits bounded blocks", "[encoder]")
+{
+    const size_t blockSize = 1000;
+    std::vector<unsigned char> data = sampleData(4321);
+    std::vector<unsigned char> encoded;
+    size_t largestPiece = 0;
+
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            largestPiece = size > largestPiece ? size : largestPiece;
+            return true;
+        },
+        blockSize);
+
+    // Push in uneven pieces, including one larger than a block
+    REQUIRE(encoder.push(data.data(), 10));
+    REQUIRE(encoder.push(data.data() + 10, 2500));
+    REQUIRE(encoder.push(data.data() + 2510, data.size() - 2510));
+    REQUIRE(encoder.finish());
+    REQUIRE(encoder.isFinished());
+    REQUIRE(!encoder.push(data.data(), 1));
+    REQUIRE(largestPiece <= huffman::blockBound(blockSize));
+
+    // Walk the block headers
+    size_t pos = 0;
+    size_t total = 0;
+    int numBlocks = 0;
+    bool last = false;
+    while (!last)
+    {
+        huffman::BlockHeader header;
+        REQUIRE(huffman::readBlockHeader(&encoded[pos], encoded.size() - pos,
+                                         header));
+        last = header.last;
+        // the short last block gets a static codebook
+        REQUIRE(header.type
+                == (last ? huffman::blockStatic : huffman::blockHuffman));
+        REQUIRE(header.compact == !last);
+
+        REQUIRE(header.rawSize <= blockSize);
+        total += header.rawSize;
+        pos += huffman::blockHeaderSize + header.payloadSize;
+        numBlocks++;
+    }
+    REQUIRE(pos == encoded.size());
+    REQUIRE(total == data.size());
+    REQUIRE(numBlocks == 5);
+}
+
+TEST_CASE("streaming encoder ends an exact multiple of blocks",
+          "[encoder]")
+{
+    std::vector<unsigned char> data = sampleData(200);
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        100);
+
+    REQUIRE(encoder.push(data.data(), data.size()));
+    size_t beforeFinish = encoded.size();
+    REQUIRE(encoder.finish());
+
+    // finish emits an empty last block
+    REQUIRE(encoded.size() == beforeFinish + huffman::blockHeaderSize);
+    REQUIRE(encoded[beforeFinish]
+            == (huffman::blockHuffman | huffman::lastBlockFlag));
+    REQUIRE(huffman::getLE32(&encoded[beforeFinish + 1]) == 0);
+}
+
+// Encodes data with encodeBuffer and checks that decodeBuffer restores it
+void requireBufferRoundTrip(const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> encoded(huffman::compressBound(data.size()));
+    size_t encodedSize = 0;
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+    REQUIRE(encodedSize <= encoded.size());
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t decodedSize = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encodedSize, decoded.data(),
+                                  decoded.size(), decodedSize) == 0);
+    REQUIRE(decodedSize == data.size());
+    REQUIRE(decoded == data);
+}
+
+TEST_CASE("buffers round-trip", "[buffer]")
+{
+    SECTION("empty input")
+    {
+        requireBufferRoundTrip(std::vector<unsigned char>());
+    }
+
+    SECTION("a single byte")
+    {
+        requireBufferRoundTrip(std::vector<unsigned char>{'x'});
+    }
+
+    SECTION("one repeated byte")
+    {
+        requireBufferRoundTrip(std::vector<unsigned char>(5000, 0));
+    }
+
+    SECTION("text")
+    {
+        requireBufferRoundTrip(sampleData(2048));
+    }
+
+    SECTION("every byte value")
+    {
+        std::vector<unsigned char> data(70000);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            data[i] = rand() % 256;
+        }
+        requireBufferRoundTrip(data);
+    }
+
+    SECTION("several blocks")
+    {
+        requireBufferRoundTrip(sampleData(3 * huffman::defaultBlockSize + 17));
+        requireBufferRoundTrip(sampleData(2 * huffman::defaultBlockSize));
+    }
+}
+
+TEST_CASE("buffer functions respect capacities", "[buffer]")
+{
+    std::vector<unsigned char> data = sampleData(3000);
+    std::vector<unsigned char> encoded(huffman::compressBound(data.size()));
+    size_t encodedSize = 0;
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+
+    // Encoding into every too-small size fails without writing past the end
+    const unsigned char guard = 0xA5;
+    for (size_t capacity = 0; capacity < encodedSize; capacity += 7)
+    {
+        std::vector<unsigned char> small(capacity + 16, guard);
+        size_t written = 0;
+        REQUIRE(huffman::encodeBuffer(data.data(), data.size(), small.data(),
+                                      capacity, written) == 3);
+        for (size_t i = capacity; i < small.size(); i++)
+        {
+            REQUIRE(small[i] == guard);
+        }
+    }
+
+    // Decoding into a too-small output fails
+    std::vector<unsigned char> decoded(data.size() - 1);
+    size_t decodedSize = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encodedSize, decoded.data(),
+                                  decoded.size(), decodedSize) == 3);
+}
+
+// Encodes and decodes data with the buffer functions, recording whether it
+// round-trips, on a thread of its own
+struct SmallStackJob
+{
+    std::vector<unsigned char> data;
+    bool ok;
+};
+
+void* runSmallStackJob(void* arg)
+{
+    SmallStackJob& job = *(SmallStackJob*)arg;
+    std::vector<unsigned char> encoded(huffman::compressBound(job.data.size()));
+    std::vector<unsigned char> decoded(job.data.size());
+    size_t encodedSize = 0;
+    size_t decodedSize = 0;
+    job.ok = huffman::encodeBuffer(job.data.data(), job.data.size(),
+                                   encoded.data(), encoded.size(),
+                                   encodedSize) == 0
+             && huffman::decodeBuffer(encoded.data(), encodedSize,
+                                      decoded.data(), decoded.size(),
+                                      decodedSize) == 0
+             && decoded == job.data;
+    return NULL;
+}
+
+TEST_CASE("buffers encode on threads with small stacks", "[buffer]")
+{
+    for (size_t size : {2000, 300000})
+    {
+        INFO("size: " << size);
+        SmallStackJob job = {sampleData(size), false};
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 256 << 10);
+        pthread_t thread;
+        REQUIRE(pthread_create(&thread, &attr, runSmallStackJob, &job) == 0);
+        pthread_join(thread, NULL);
+        pthread_attr_destroy(&attr);
+        REQUIRE(job.ok);
+    }
+}
+
+TEST_CASE("decoding rejects corrupt input", "[buffer]")
+{
+    std::vector<unsigned char> data = sampleData(3000);
+    std::vector<unsigned char> encoded(huffman::compressBound(data.size()));
+    size_t encodedSize = 0;
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+    std::vector<unsigned char> decoded(data.size());
+    size_t decodedSize = 0;
+
+    // truncated
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encodedSize - 1,
+                                  decoded.data(), decoded.size(),
+                                  decodedSize) == 4);
+
+    // a codeword length table that isn't a prefix code
+    std::vector<unsigned char> corrupt(encoded.begin(),
+                                       encoded.begin() + encodedSize);
+    for (int c = 0; c < 8; c++)
+    {
+        corrupt[huffman::blockHeaderSize + c] = 1;
+    }
+    REQUIRE(huffman::decodeBuffer(corrupt.data(), corrupt.size(),
+                                  decoded.data(), decoded.size(),
+                                  decodedSize) == 4);
+}
+
+TEST_CASE("streaming encoder output decodes", "[encoder][buffer]")
+{
+    std::vector<unsigned char> data = sampleData(10000);
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        777);
+    for (size_t i = 0; i < data.size(); i += 100)
+    {
+        REQUIRE(encoder.push(data.data() + i, 100));
+    }
+    REQUIRE(encoder.finish());
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t decodedSize = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(),
+                                  decodedSize) == 0);
+    REQUIRE(decoded == data);
+}
+
+TEST_CASE("large blocks are interleaved when they fit", "[buffer]")
+{
+    std::vector<unsigned char> data = sampleData(100000);
+    std::vector<unsigned char> encoded(huffman::compressBound(data.size()));
+    size_t encodedSize = 0;
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+    huffman::BlockHeader header;
+    REQUIRE(huffman::readBlockHeader(encoded.data(), encodedSize, header));
+    REQUIRE(header.type == huffman::blockInterleaved);
+    requireBufferRoundTrip(data);
+
+    // incompressible data isn't coded at all
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = i * 7 + i / 256;
+    }
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+    REQUIRE(huffman::readBlockHeader(encoded.data(), encodedSize, header));
+    REQUIRE(header.type == huffman::blockStored);
+    requireBufferRoundTrip(data);
+}
+
+TEST_CASE("blocks a code barely shrinks are stored", "[buffer][stored]")
+{
+    // random bytes, then text whose code repeats after them
+    std::mt19937 rng(7);
+    std::vector<unsigned char> data(3 * 4096);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = rng();
+    }
+    std::vector<unsigned char> text = sampleData(2 * 4096);
+    data.insert(data.end(), text.begin(), text.end());
+    data.insert(data.end(), data.begin(), data.begin() + 4096);
+    data.insert(data.end(), text.begin(), text.end());
+
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        4096);
+    REQUIRE(encoder.push(data.data(), data.size()));
+    REQUIRE(encoder.finish());
+
+    std::vector<huffman::BlockType> types;
+    std::vector<bool> repeats;
+    size_t pos = 0;
+    huffman::BlockHeader header;
+    do
+    {
+        REQUIRE(huffman::readBlockHeader(&encoded[pos], encoded.size() - pos,
+                                         header));
+        types.push_back(header.type);
+        repeats.push_back(huffman::repeatsCode(header, &encoded[pos + 9]));
+        if (header.type == huffman::blockStored)
+        {
+            REQUIRE(header.payloadSize == header.rawSize);
+            REQUIRE(!header.compact);
+        }
+        pos += huffman::blockHeaderSize + header.payloadSize;
+    }
+    while (!header.last);
+
+    REQUIRE(types.size() == 9);
+    for (size_t i : {0, 1, 2, 5})
+    {
+        REQUIRE(types[i] == huffman::blockStored);
+    }
+    for (size_t i : {3, 4, 6, 7})
+    {
+        REQUIRE(types[i] == huffman::blockHuffman);
+    }
+
+    // the text after the stored block repeats the code from before it
+    REQUIRE(repeats[6]);
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t written = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(), written)
+            == 0);
+    REQUIRE(written == data.size());
+    REQUIRE(decoded == data);
+
+    // a stored block must hold exactly what it decodes to
+    unsigned char corrupt[huffman::blockHeaderSize + 2] = {
+        huffman::blockStored | huffman::lastBlockFlag, 3, 0, 0, 0, 2, 0, 0, 0,
+        'a', 'b'};
+    REQUIRE(huffman::decodeBuffer(corrupt, sizeof(corrupt), decoded.data(),
+                                  decoded.size(), written) == 4);
+}
+
+TEST_CASE("runs of one byte take a byte", "[buffer][run]")
+{
+    // a zero-filled region between text, and a run of one other byte
+    std::vector<unsigned char> data = sampleData(4096);
+    data.resize(data.size() + 5 * 4096, 0);
+    std::vector<unsigned char> text = sampleData(4096);
+    data.insert(data.end(), text.begin(), text.end());
+    data.resize(data.size() + 100, 'x');
+
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        4096);
+    REQUIRE(encoder.push(data.data(), data.size()));
+    REQUIRE(encoder.finish());
+
+    std::vector<huffman::BlockType> types;
+    size_t pos = 0;
+    huffman::BlockHeader header;
+    do
+    {
+        REQUIRE(huffman::readBlockHeader(&encoded[pos], encoded.size() - pos,
+                                         header));
+        types.push_back(header.type);
+        if (header.type == huffman::blockRun)
+        {
+            REQUIRE(header.payloadSize == 1);
+        }
+        pos += huffman::blockHeaderSize + header.payloadSize;
+    }
+    while (!header.last);
+
+    REQUIRE(types.size() == 8);
+    for (size_t i : {1, 2, 3, 4, 5, 7})
+    {
+        REQUIRE(types[i] == huffman::blockRun);
+    }
+    REQUIRE(encoded[pos - 1] == 'x');
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t written = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(), written)
+            == 0);
+    REQUIRE(written == data.size());
+    REQUIRE(decoded == data);
+
+    requireBufferRoundTrip(std::vector<unsigned char>(1, 0));
+    requireBufferRoundTrip(std::vector<unsigned char>(1 << 20, 0xff));
+
+    // a run block holds exactly one byte
+    unsigned char corrupt[huffman::blockHeaderSize + 2] = {
+        huffman::blockRun | huffman::lastBlockFlag, 3, 0, 0, 0, 2, 0, 0, 0,
+        'a', 'a'};
+    REQUIRE(huffman::decodeBuffer(corrupt, sizeof(corrupt), decoded.data(),
+                                  decoded.size(), written) == 4);
+}
+
+TEST_CASE("blocks repeat the last code when it's smaller", "[encoder]")
+{
+    // text throughout, then bytes the text's code doesn't have
+    std::vector<unsigned char> data = sampleData(40 * 4096);
+    for (size_t i = 0; i < 4096; i++)
+    {
+        data.push_back(128 + i % 128);
+    }
+
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        4096);
+    REQUIRE(encoder.push(data.data(), data.size()));
+    REQUIRE(encoder.finish());
+
+    std::vector<bool> repeats;
+    size_t pos = 0;
+    huffman::BlockHeader header;
+    do
+    {
+        REQUIRE(huffman::readBlockHeader(&encoded[pos], encoded.size() - pos,
+                                         header));
+        repeats.push_back(huffman::repeatsCode(header, &encoded[pos + 9]));
+        pos += huffman::blockHeaderSize + header.payloadSize;
+    }
+    while (!header.last);
+
+    // the first block has to give its code, and so does the binary one
+    REQUIRE(repeats.size() == 42);
+    REQUIRE(!repeats[0]);
+    REQUIRE(!repeats[40]);
+    size_t run = 0;
+    for (size_t i = 0; i < 40; i++)
+    {
+        run = repeats[i] ? run + 1 : 0;
+        REQUIRE(run <= huffman::maxRepeatRun);
+    }
+    REQUIRE(std::count(repeats.begin(), repeats.end(), true) > 30);
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t written = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(), written)
+            == 0);
+    REQUIRE(written == data.size());
+    REQUIRE(decoded == data);
+
+    // a repeat without a code before it is corrupt
+    REQUIRE(repeats[1]);
+    size_t second = huffman::blockHeaderSize + huffman::getLE32(&encoded[5]);
+    REQUIRE(huffman::decodeBuffer(&encoded[second], encoded.size() - second,
+                                  decoded.data(), decoded.size(), written)
+            == 4);
+}
+
+TEST_CASE("blocks split where the content changes", "[encoder][split]")
+{
+    // ten granules of text, then high bytes the text's code doesn't have
+    std::vector<unsigned char> data = sampleData(10 * huffman::splitGranule);
+    for (size_t i = 0; i < 6 * huffman::splitGranule; i++)
+    {
+        data.push_back(128 + (i * 7 + i / 5) % 128);
+    }
+
+    REQUIRE(huffman::chooseBlockEnd(data.data(), data.size())
+            == 10 * huffman::splitGranule);
+    REQUIRE(huffman::chooseBlockEnd(data.data(), 10 * huffman::splitGranule)
+            == 10 * huffman::splitGranule);
+
+    // the counts it hands on are those of the block it chose
+    uint64_t counts[huffman::numSymbols];
+    uint64_t expected[huffman::numSymbols] = {0};
+    huffman::countChars(data.data(), 10 * huffman::splitGranule, expected);
+    REQUIRE(huffman::chooseBlockEnd(data.data(), data.size(), counts)
+            == 10 * huffman::splitGranule);
+    REQUIRE(std::equal(counts, counts + huffman::numSymbols, expected));
+
+    std::vector<unsigned char> encoded;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            encoded.insert(encoded.end(), piece, piece + size);
+            return true;
+        },
+        16 * huffman::splitGranule);
+    REQUIRE(encoder.push(data.data(), data.size()));
+    REQUIRE(encoder.finish());
+
+    huffman::BlockHeader header;
+    REQUIRE(huffman::readBlockHeader(encoded.data(), encoded.size(), header));
+    REQUIRE(header.rawSize == 10 * huffman::splitGranule);
+    REQUIRE(!header.last);
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t written = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(), written)
+            == 0);
+    REQUIRE(written == data.size());
+    REQUIRE(decoded == data);
+}
+
+TEST_CASE("blocks with the full codebook still decode", "[buffer]")
+{
+    std::vector<unsigned char> data = sampleData(5000);
+    uint64_t counts[huffman::numSymbols] = {0};
+    huffman::countChars(data.data(), data.size(), counts);
+    huffman::CodeTable table;
+    huffman::buildCodeTable(counts, table);
+
+    // the layout before compact codebooks: every length, then the codes
+    std::vector<unsigned char> encoded(huffman::blockHeaderSize);
+    encoded[0] = huffman::blockHuffman | huffman::lastBlockFlag;
+    huffman::putLE32(&encoded[1], data.size());
+    for (unsigned int c = 0; c < huffman::numSymbols; c++)
+    {
+        encoded.push_back(table.lens[c]);
+    }
+    size_t start = encoded.size();
+    encoded.resize(start + huffman::packBound(table, data.size()));
+    huffman::PackState state = {0, 0};
+    size_t n = huffman::packCodes(table, data.data(), data.size(), state,
+                                  &encoded[start]);
+    n += huffman::flushBits(state, &encoded[start + n]);
+    encoded.resize(start + n);
+    huffman::putLE32(&encoded[5], encoded.size() - huffman::blockHeaderSize);
+
+    std::vector<unsigned char> decoded(data.size());
+    size_t written = 0;
+    REQUIRE(huffman::decodeBuffer(encoded.data(), encoded.size(),
+                                  decoded.data(), decoded.size(), written)
+            == 0);
+    REQUIRE(decoded == data);
+
+    // and the compact one is much smaller
+    std::vector<unsigned char> compact(huffman::compressBound(data.size()));
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), compact.data(),
+                                  compact.size(), written) == 0);
+    REQUIRE(written + 150 < encoded.size());
+}
+
+TEST_CASE("small inputs use a static codebook", "[buffer][static]")
+{
+    const std::string json =
+        "{\"id\": 1234, \"name\": \"example\", \"tags\": [\"a\", \"b\"], "
+        "\"active\": true, \"score\": 0.75}";
+    std::vector<unsigned char> data(json.begin(), json.end());
+
+    std::vector<unsigned char> encoded(huffman::compressBound(data.size()));
+    size_t encodedSize = 0;
+    REQUIRE(huffman::encodeBuffer(data.data(), data.size(), encoded.data(),
+                                  encoded.size(), encodedSize) == 0);
+    REQUIRE((encoded[0] & ~huffman::lastBlockFlag) == huffman::blockStatic);
+    REQUIRE(encoded[huffman::blockHeaderSize] == huffman::bookJson);
+    REQUIRE(encodedSize < huffman::blockHeaderSize + data.size());
+
+    requireBufferRoundTrip(data);
+
+    // Every static codebook can code every byte
+    std::vector<unsigned char> allBytes(256);
+    for (int c = 0; c < 256; c++)
+    {
+        allBytes[c] = c;
+    }
+    requireBufferRoundTrip(allBytes);
+
+    const std::string text = "The quick brown fox jumps over the lazy dog.";
+    REQUIRE(huffman::chooseStaticBook((const unsigned char*)text.data(),
+                                      text.size()) == huffman::bookText);
+    requireBufferRoundTrip(std::vector<unsigned char>(text.begin(),
+                                                      text.end()));
+}
+
+// Writes data to path
+void writeFile(const std::string& path, const std::vector<unsigned char>& data)
+{
+    std::ofstream f(path, std::ofstream::out | std::ofstream::binary);
+    f.write((const char*)data.data(), data.size());
+}
+
+// Returns the contents of path
+std::vector<unsigned char> readFile(const std::string& path)
+{
+    std::ifstream f(path, std::ifstream::in | std::ifstream::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(f),
+                                      std::istreambuf_iterator<char>());
+}
+
+// Encodes data to a file with encode and with encodeLegacy, and checks that
+// decode restores it from both
+void requireFileRoundTrip(const std::vector<unsigned char>& data)
+{
+    const std::string path = "testHuffman.txt";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    writeFile(path, data);
+    for (bool legacy : {false, true})
+    {
+        REQUIRE((legacy ? huffman::encodeLegacy(path.c_str(),
+                                                encodedPath.c_str())
+                        : huffman::encode(path.c_str(), encodedPath.c_str()))
+                == 0);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 0);
+        REQUIRE(readFile(decodedPath) == data);
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+// Returns a small JSON record like the ones a dictionary is trained for
+std::string sampleRecord(unsigned int i)
+{
+    std::ostringstream record;
+    record << "{\"id\":" << i << ",\"name\":\"user" << rand() % 1000
+           << "\",\"active\":" << (rand() % 2 ? "true" : "false")
+           << ",\"tags\":[";
+    for (int t = rand() % 8; t > 0; t--)
+    {
+        record << "\"tag" << rand() % 50 << "\",";
+    }
+    record << "\"end\"],\"score\":" << rand() % 100000 << "}";
+    return record.str();
+}
+
+TEST_CASE("small objects encode against a shared dictionary",
+          "[dictionary]")
+{
+    const std::string dictPath = "testDictionary.hufdict";
+
+    std::vector<std::string> records;
+    uint64_t counts[huffman::numSymbols] = {0};
+    for (unsigned int i = 0; i < 500; i++)
+    {
+        records.push_back(sampleRecord(i));
+        huffman::countChars((const unsigned char*)records.back().data(),
+                            records.back().size(), counts);
+    }
+    huffman::Dictionary trained;
+    huffman::trainDictionary(counts, trained);
+    for (unsigned int c = 0; c < huffman::numSymbols; c++)
+    {
+        REQUIRE(trained.lengths[c] > 0);
+        REQUIRE(trained.lengths[c] <= huffman::maxDictionaryBits);
+    }
+    REQUIRE(huffman::saveDictionary(trained, dictPath.c_str()) == 0);
+
+    // loading again hands out the same dictionary
+    huffman::DictionaryCache cache;
+    std::shared_ptr<const huffman::Dictionary> dict = cache.load(dictPath);
+    REQUIRE(dict);
+    REQUIRE(dict->id == trained.id);
+    REQUIRE(cache.load(dictPath) == dict);
+    REQUIRE(cache.get(trained.id) == dict);
+
+    // each object carries only the dictionary's id, and decodes from many
+    // threads at once
+    std::vector<std::vector<unsigned char>> encoded(records.size());
+    size_t total = 0;
+    size_t alone = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const unsigned char* in = (const unsigned char*)records[i].data();
+        size_t size = records[i].size();
+        encoded[i].resize(huffman::objectBound(size));
+        size_t written = 0;
+        REQUIRE(huffman::encodeObject(*dict, in, size, encoded[i].data(),
+                                      encoded[i].size(), written) == 0);
+        encoded[i].resize(written);
+        total += written;
+
+        std::vector<unsigned char> buffer(huffman::compressBound(size));
+        REQUIRE(huffman::encodeBuffer(in, size, buffer.data(), buffer.size(),
+                                      written) == 0);
+        alone += written;
+    }
+    REQUIRE(total < alone);
+
+    std::atomic<int> failures(0);
+    huffman::parallelFor(records.size(), [&](size_t i)
+    {
+        std::vector<unsigned char> out(records[i].size());
+        size_t written = 0;
+        if (huffman::decodeObject(cache, encoded[i].data(), encoded[i].size(),
+                                  out.data(), out.size(), written) != 0
+            || std::string(out.begin(), out.end()) != records[i])
+        {
+            failures++;
+        }
+    }, 4);
+    REQUIRE(failures == 0);
+
+    std::vector<unsigned char> out(1000);
+    size_t written = 0;
+    SECTION("without the dictionary")
+    {
+        huffman::DictionaryCache empty;
+        REQUIRE(huffman::decodeObject(empty, encoded[0].data(),
+                                      encoded[0].size(), out.data(),
+                                      out.size(), written) == 7);
+        REQUIRE(huffman::decodeBuffer(encoded[0].data(), encoded[0].size(),
+                                      out.data(), out.size(), written) == 4);
+    }
+
+    SECTION("dictionary objects flagged with what they don't have")
+    {
+        huffman::BlockHeader header;
+        REQUIRE(huffman::readBlockHeader(encoded[0].data(), encoded[0].size(),
+                                         header));
+        REQUIRE(header.type == huffman::blockDictionary);
+        for (unsigned char flag : {huffman::checksumFlag,
+                                   huffman::compactCodebookFlag})
+        {
+            INFO("flag: " << (int)flag);
+            std::vector<unsigned char> flagged(encoded[0]);
+            flagged[0] |= flag;
+            REQUIRE(huffman::decodeObject(cache, flagged.data(),
+                                          flagged.size(), out.data(),
+                                          out.size(), written) == 4);
+        }
+    }
+
+    SECTION("objects the dictionary can't shrink")
+    {
+        std::vector<unsigned char> binary(300);
+        for (size_t i = 0; i < binary.size(); i++)
+        {
+            binary[i] = 128 + rand() % 128;
+        }
+        std::vector<unsigned char> object(huffman::objectBound(300));
+        REQUIRE(huffman::encodeObject(*dict, binary.data(), binary.size(),
+                                      object.data(), object.size(), written)
+                == 0);
+        REQUIRE(written <= huffman::blockHeaderSize + binary.size());
+        REQUIRE(huffman::decodeObject(cache, object.data(), written,
+                                      out.data(), out.size(), written) == 0);
+        REQUIRE(std::equal(binary.begin(), binary.end(), out.begin()));
+    }
+
+    SECTION("objects longer than a block")
+    {
+        std::vector<unsigned char> text = sampleData(huffman::maxBlockSize
+                                                     + 1);
+        std::vector<unsigned char> object(huffman::objectBound(text.size()));
+        REQUIRE(huffman::encodeObject(*dict, text.data(), text.size(),
+                                      object.data(), object.size(), written)
+                == 1);
+        REQUIRE(written == 0);
+    }
+
+    SECTION("a damaged dictionary file")
+    {
+        unsigned char data[huffman::dictionaryFileSize];
+        huffman::putDictionary(trained, data);
+        huffman::Dictionary read;
+        REQUIRE(huffman::readDictionary(data, sizeof(data), read));
+        REQUIRE(read.id == trained.id);
+        data[100]++;
+        REQUIRE(!huffman::readDictionary(data, sizeof(data), read));
+        REQUIRE(!huffman::DictionaryCache().load("no such file"));
+    }
+
+    remove(dictPath.c_str());
+}
+
+TEST_CASE("dictionaries train from clusters of similar samples",
+          "[dictionary][train]")
+{
+    const std::string dir = "testSamples";
+    mkdir(dir.c_str(), 0755);
+
+    // JSON records and runs of digits, which want different codes
+    std::vector<std::string> paths;
+    for (unsigned int i = 0; i < 40; i++)
+    {
+        std::string sample = sampleRecord(i);
+        if (i % 2 == 1)
+        {
+            sample.clear();
+            for (int j = 0; j < 200; j++)
+            {
+                sample.push_back('0' + rand() % 10);
+            }
+        }
+        paths.push_back(dir + "/sample" + std::to_string(i));
+        writeFile(paths.back(), std::vector<unsigned char>(sample.begin(),
+                                                           sample.end()));
+    }
+
+    std::vector<huffman::TrainedDictionary> trained;
+    REQUIRE(huffman::train(dir.c_str(), 4, trained) == 0);
+    REQUIRE(trained.size() >= 2);
+    REQUIRE(trained.size() <= 4);
+    size_t numSamples = 0;
+    for (size_t i = 0; i < trained.size(); i++)
+    {
+        numSamples += trained[i].numSamples;
+        REQUIRE(trained[i].bitsPerByte > 0);
+        REQUIRE(trained[i].bitsPerByte < 8);
+        REQUIRE((i == 0 || trained[i].numBytes <= trained[i - 1].numBytes));
+    }
+    REQUIRE(numSamples == paths.size());
+
+    // the digits get a dictionary of their own, which codes them in about
+    // the log2(10) bits they need
+    bool digitsAlone = false;
+    for (const huffman::TrainedDictionary& t : trained)
+    {
+        digitsAlone = digitsAlone || t.bitsPerByte < 3.5;
+    }
+    REQUIRE(digitsAlone);
+
+    // one dictionary codes everything no better than several
+    std::vector<huffman::TrainedDictionary> one;
+    REQUIRE(huffman::train(dir.c_str(), 1, one) == 0);
+    REQUIRE(one.size() == 1);
+    REQUIRE(one[0].numSamples == paths.size());
+    double bits = 0;
+    for (const huffman::TrainedDictionary& t : trained)
+    {
+        bits += t.bitsPerByte * t.numBytes;
+    }
+    REQUIRE(bits < one[0].bitsPerByte * one[0].numBytes);
+
+    REQUIRE(huffman::train("no such directory", 4, trained) == 1);
+
+    for (const std::string& path : paths)
+    {
+        remove(path.c_str());
+    }
+    remove(dir.c_str());
+}
+
+TEST_CASE("files round-trip", "[file]")
+{
+    SECTION("empty file")
+    {
+        requireFileRoundTrip(std::vector<unsigned char>());
+    }
+
+    SECTION("one repeated byte")
+    {
+        requireFileRoundTrip(std::vector<unsigned char>(1000, 'z'));
+    }
+
+    SECTION("text")
+    {
+        requireFileRoundTrip(sampleData(200000));
+    }
+
+    SECTION("counts that would give codewords too long to hold")
+    {
+        // Fibonacci counts summing past F(36) would give a 34-bit codeword
+        std::vector<unsigned char> data;
+        unsigned int a = 1, b = 1;
+        for (unsigned char c = '0'; c < '0' + 35; c++)
+        {
+            data.insert(data.end(), a, c);
+            unsigned int next = a + b;
+            a = b;
+            b = next;
+        }
+        requireFileRoundTrip(data);
+    }
+
+    SECTION("codewords longer than the first-level table")
+    {
+        // Fibonacci counts give the deepest possible tree
+        std::vector<unsigned char> data;
+        unsigned int a = 1, b = 1;
+        for (unsigned char c = 'A'; c < 'A' + 20; c++)
+        {
+            data.insert(data.end(), a, c);
+            unsigned int next = a + b;
+            a = b;
+            b = next;
+        }
+        std::shuffle(data.begin(), data.end(), std::mt19937(1));
+        requireFileRoundTrip(data);
+    }
+}
+
+TEST_CASE("indexed files decode on several threads", "[file][parallel]")
+{
+    const std::string path = "testIndexed.txt";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    // enough for several blocks, the last one partial
+    std::vector<unsigned char> data = sampleData(5 * huffman::defaultBlockSize
+                                                 + 1234);
+    writeFile(path, data);
+    REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str()) == 0);
+
+    std::vector<unsigned char> encoded = readFile(encodedPath);
+    REQUIRE(huffman::isIndexedFile(encoded.data(), encoded.size()));
+
+    for (unsigned int threads : {1, 2, 4, 7})
+    {
+        INFO("threads: " << threads);
+        remove(decodedPath.c_str());
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                threads) == 0);
+        REQUIRE(readFile(decodedPath) == data);
+    }
+
+    SECTION("a damaged block")
+    {
+        // an unknown type in the first block's header
+        encoded[huffman::frameHeaderSize] = 0x7f;
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                4) == 4);
+    }
+
+    SECTION("a missing index")
+    {
+        encoded.resize(encoded.size() - 20);
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                4) == 4);
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("files start with a versioned frame header", "[file][frame]")
+{
+    const std::string path = "testFrame.txt";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    std::vector<unsigned char> data = sampleData(3 * 4096 + 5);
+    writeFile(path, data);
+    REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str(), 4096, true)
+            == 0);
+    std::vector<unsigned char> encoded = readFile(encodedPath);
+
+    huffman::FrameHeader frame;
+    REQUIRE(huffman::readFrameHeader(encoded.data(), encoded.size(), frame)
+            == huffman::frameOk);
+    REQUIRE(frame.version == huffman::frameVersion);
+    REQUIRE(frame.flags == (huffman::frameContentSize
+                            | huffman::frameChecksums
+                            | huffman::frameLength));
+    REQUIRE(frame.blockSize == 4096);
+    REQUIRE(frame.contentSize == data.size());
+    REQUIRE(frame.length == encoded.size());
+    REQUIRE(frame.size == huffman::frameHeaderSize);
+
+    // the stream decoder knows the size once the header is in
+    huffman::StreamDecoder decoder(
+        [](const unsigned char*, size_t) { return true; });
+    uint64_t contentSize = 0;
+    REQUIRE(decoder.push(encoded.data(), 5));
+    REQUIRE(!decoder.getContentSize(contentSize));
+    REQUIRE(decoder.push(encoded.data() + 5, encoded.size() - 5));
+    REQUIRE(decoder.getContentSize(contentSize));
+    REQUIRE(contentSize == data.size());
+    REQUIRE(decoder.finish());
+
+    SECTION("a content size that doesn't match the blocks")
+    {
+        encoded[10]++;
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 4);
+        std::istringstream in(std::string(encoded.begin(), encoded.end()));
+        std::ostringstream out;
+        REQUIRE(huffman::decode(in, out) == 4);
+    }
+
+    SECTION("a length that doesn't match the frame")
+    {
+        encoded[18]--;
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 4);
+        std::istringstream in(std::string(encoded.begin(), encoded.end()));
+        std::ostringstream out;
+        REQUIRE(huffman::decode(in, out) == 4);
+    }
+
+    SECTION("a newer version")
+    {
+        encoded[4] = huffman::frameVersion + 1;
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 6);
+        REQUIRE(huffman::verify(encodedPath.c_str()) == 6);
+        std::istringstream in(std::string(encoded.begin(), encoded.end()));
+        std::ostringstream out;
+        REQUIRE(huffman::decode(in, out) == 4);
+    }
+
+    SECTION("frames from before the length was given")
+    {
+        // a version 1 header, whose frame is found by its blocks
+        std::vector<unsigned char> old(encoded.begin(),
+                                       encoded.begin()
+                                       + huffman::frameHeaderSizeV1);
+        old[4] = 1;
+        old[5] &= ~huffman::frameLength;
+        std::vector<huffman::IndexEntry> index;
+        huffman::Encoder encoder(
+            [&](const unsigned char* piece, size_t size)
+            {
+                huffman::BlockHeader header;
+                huffman::readBlockHeader(piece, size, header);
+                index.push_back({old.size(), header.rawSize});
+                old.insert(old.end(), piece, piece + size);
+                return true;
+            },
+            4096, true);
+        REQUIRE(encoder.push(data.data(), data.size()));
+        REQUIRE(encoder.finish());
+        huffman::putIndex(index, old);
+        old.insert(old.end(), encoded.begin(), encoded.end());
+        writeFile(encodedPath, old);
+
+        REQUIRE(huffman::readFrameHeader(old.data(), old.size(), frame)
+                == huffman::frameOk);
+        REQUIRE(frame.version == 1);
+        REQUIRE(frame.size == huffman::frameHeaderSizeV1);
+        std::vector<unsigned char> twice(data);
+        twice.insert(twice.end(), data.begin(), data.end());
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 0);
+        REQUIRE(readFile(decodedPath) == twice);
+        std::istringstream in(std::string(old.begin(), old.end()));
+        std::ostringstream out;
+        REQUIRE(huffman::decode(in, out) == 0);
+        REQUIRE(out.str() == std::string(twice.begin(), twice.end()));
+    }
+
+    SECTION("files from before the frame header")
+    {
+        // the same blocks after only the old magic, and indexed from there
+        std::vector<unsigned char> old(huffman::fileMagic,
+                                       huffman::fileMagic + 4);
+        std::vector<huffman::IndexEntry> index;
+        huffman::Encoder encoder(
+            [&](const unsigned char* piece, size_t size)
+            {
+                huffman::BlockHeader header;
+                huffman::readBlockHeader(piece, size, header);
+                index.push_back({old.size(), header.rawSize});
+                old.insert(old.end(), piece, piece + size);
+                return true;
+            },
+            4096);
+        REQUIRE(encoder.push(data.data(), data.size()));
+        REQUIRE(encoder.finish());
+        huffman::putIndex(index, old);
+        writeFile(encodedPath, old);
+
+        REQUIRE(huffman::readFrameHeader(old.data(), old.size(), frame)
+                == huffman::frameOk);
+        REQUIRE(frame.version == 0);
+        REQUIRE(frame.size == 4);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 0);
+        REQUIRE(readFile(decodedPath) == data);
+        REQUIRE(huffman::verify(encodedPath.c_str()) == 0);
+        std::istringstream in(std::string(old.begin(), old.end()));
+        std::ostringstream out;
+        REQUIRE(huffman::decode(in, out) == 0);
+        REQUIRE(out.str() == std::string(data.begin(), data.end()));
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("files concatenate frame by frame", "[file][frame]")
+{
+    const std::string firstPath = "testConcatA.txt";
+    const std::string secondPath = "testConcatB.txt";
+    const std::string encodedPath = "testConcat.txt.huf";
+    const std::string decodedPath = "testConcat.txt.out";
+
+    // frames with different block sizes and checksums, some metadata
+    // between them, and a third frame appended in place
+    std::vector<unsigned char> first = sampleData(3 * 4096 + 5);
+    std::vector<unsigned char> second(5000, 'z');
+    second.insert(second.end(), first.begin(), first.begin() + 9000);
+    writeFile(firstPath, first);
+    writeFile(secondPath, second);
+    remove(encodedPath.c_str());
+    REQUIRE(huffman::encodeAppend(firstPath.c_str(), encodedPath.c_str(),
+                                  4096, true) == 0);
+    const unsigned char note[] = "made by the test";
+    REQUIRE(huffman::appendMetadata(encodedPath.c_str(), note, sizeof(note))
+            == 0);
+    REQUIRE(huffman::encodeAppend(secondPath.c_str(), encodedPath.c_str(),
+                                  8192) == 0);
+    REQUIRE(huffman::encodeAppend(firstPath.c_str(), encodedPath.c_str())
+            == 0);
+
+    std::vector<unsigned char> data = first;
+    data.insert(data.end(), second.begin(), second.end());
+    data.insert(data.end(), first.begin(), first.end());
+
+    // the appended file is what encoding each piece and concatenating
+    // them makes
+    std::vector<unsigned char> encoded = readFile(encodedPath);
+    REQUIRE(huffman::encode(firstPath.c_str(), decodedPath.c_str()) == 0);
+    std::vector<unsigned char> last = readFile(decodedPath);
+    REQUIRE(std::equal(last.begin(), last.end(),
+                       encoded.end() - last.size()));
+
+    for (unsigned int threads : {1u, 3u, 0u})
+    {
+        INFO("threads: " << threads);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                threads) == 0);
+        REQUIRE(readFile(decodedPath) == data);
+    }
+    REQUIRE(huffman::verify(encodedPath.c_str()) == 0);
+
+    std::istringstream in(std::string(encoded.begin(), encoded.end()));
+    std::ostringstream out;
+    REQUIRE(huffman::decode(in, out) == 0);
+    REQUIRE(out.str() == std::string(data.begin(), data.end()));
+
+    // a range across the end of the first frame
+    std::vector<unsigned char> range(10000);
+    size_t written = 0;
+    REQUIRE(huffman::decodeRange(encodedPath.c_str(), first.size() - 5000,
+                                 range.size(), range.data(), written) == 0);
+    REQUIRE(written == range.size());
+    REQUIRE(std::equal(range.begin(), range.end(),
+                       data.begin() + first.size() - 5000));
+
+    SECTION("a frame cut off by the next")
+    {
+        std::vector<unsigned char> cut(encoded.begin(), encoded.end() - 1);
+        cut.insert(cut.end(), last.begin(), last.end());
+        writeFile(encodedPath, cut);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 4);
+        REQUIRE(huffman::verify(encodedPath.c_str()) == 4);
+    }
+
+    SECTION("garbage after the last frame")
+    {
+        encoded.push_back('H');
+        writeFile(encodedPath, encoded);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 4);
+    }
+
+    remove(firstPath.c_str());
+    remove(secondPath.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("blocks select among codes shared by the frame", "[file][shared]")
+{
+    const std::string path = "testShared.txt";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    // small blocks whose statistics flip between three regimes
+    const size_t blockSize = 4096;
+    std::vector<unsigned char> data;
+    for (unsigned int b = 0; b < 60; b++)
+    {
+        for (size_t i = 0; i < blockSize; i++)
+        {
+            int r = rand();
+            data.push_back(b % 3 == 0 ? 'a' + r % 20
+                           : b % 3 == 1 ? '0' + r % 10
+                                        : 128 + (r % 7) * (r % 5));
+        }
+    }
+    writeFile(path, data);
+    REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str(), blockSize)
+            == 0);
+    std::vector<unsigned char> encoded = readFile(encodedPath);
+
+    // the codes come first, and the blocks take less than with a codebook
+    // each
+    huffman::BlockHeader header;
+    REQUIRE(huffman::readBlockHeader(encoded.data()
+                                     + huffman::frameHeaderSize,
+                                     encoded.size(), header));
+    REQUIRE(header.type == huffman::blockSharedCodes);
+    std::vector<unsigned char> alone;
+    huffman::Encoder encoder(
+        [&](const unsigned char* piece, size_t size)
+        {
+            alone.insert(alone.end(), piece, piece + size);
+            return true;
+        },
+        blockSize);
+    REQUIRE(encoder.push(data.data(), data.size()));
+    REQUIRE(encoder.finish());
+    REQUIRE(encoded.size() < alone.size());
+
+    for (unsigned int threads : {1u, 4u})
+    {
+        INFO("threads: " << threads);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                threads) == 0);
+        REQUIRE(readFile(decodedPath) == data);
+    }
+    REQUIRE(huffman::verify(encodedPath.c_str()) == 0);
+
+    std::istringstream in(std::string(encoded.begin(), encoded.end()));
+    std::ostringstream out;
+    REQUIRE(huffman::decode(in, out) == 0);
+    REQUIRE(out.str() == std::string(data.begin(), data.end()));
+
+    std::vector<unsigned char> range(3 * blockSize);
+    size_t written = 0;
+    REQUIRE(huffman::decodeRange(encodedPath.c_str(), 31 * blockSize + 7,
+                                 range.size(), range.data(), written) == 0);
+    REQUIRE(std::equal(range.begin(), range.end(),
+                       data.begin() + 31 * blockSize + 7));
+
+    SECTION("a block that selects a code it wasn't given")
+    {
+        // the frame's blocks without the shared codes before them
+        const unsigned char* first = encoded.data() + huffman::frameHeaderSize
+                                     + huffman::blockHeaderSize
+                                     + header.payloadSize;
+        size_t size = 0;
+        huffman::BlockHeader block;
+        do
+        {
+            REQUIRE(huffman::readBlockHeader(first + size,
+                                             encoded.size() - size, block));
+            size += huffman::blockHeaderSize + block.payloadSize;
+        } while (!block.last);
+
+        std::vector<unsigned char> decoded(data.size());
+        REQUIRE(huffman::decodeBuffer(first, size, decoded.data(),
+                                      decoded.size(), written) == 4);
+    }
+
+    SECTION("few or long blocks share nothing")
+    {
+        // the same regimes, in blocks too long to be worth sharing for, or
+        // too few of them
+        size_t few = (huffman::minSharedBlocks - 1) * blockSize;
+        for (bool longBlocks : {true, false})
+        {
+            INFO("long blocks: " << longBlocks);
+            writeFile(path, std::vector<unsigned char>(
+                data.begin(), longBlocks ? data.end() : data.begin() + few));
+            REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str(),
+                                    longBlocks
+                                    ? 2 * huffman::maxSharedBlockSize
+                                    : blockSize) == 0);
+            encoded = readFile(encodedPath);
+            REQUIRE(huffman::readBlockHeader(encoded.data()
+                                             + huffman::frameHeaderSize,
+                                             encoded.size(), header));
+            REQUIRE(header.type != huffman::blockSharedCodes);
+        }
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("byte ranges decode from the blocks that hold them", "[file][range]")
+{
+    const std::string path = "testRange.txt";
+    const std::string encodedPath = path + ".huf";
+
+    // small blocks, so ranges start and end in many places
+    const size_t blockSize = 4096;
+    std::vector<unsigned char> data = sampleData(20 * blockSize + 777);
+    writeFile(path, data);
+    REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str(), blockSize)
+            == 0);
+
+    std::vector<unsigned char> out(data.size() + 100);
+    size_t written = 0;
+    struct Range { uint64_t offset; size_t length; };
+    for (Range r : std::vector<Range>{{0, 10}, {0, data.size()},
+                                      {blockSize, blockSize},
+                                      {blockSize - 1, 2},
+                                      {3 * blockSize + 5, 5 * blockSize},
+                                      {data.size() - 1, 1}, {12345, 0}})
+    {
+        INFO("offset: " << r.offset << ", length: " << r.length);
+        REQUIRE(huffman::decodeRange(encodedPath.c_str(), r.offset, r.length,
+                                     out.data(), written) == 0);
+        REQUIRE(written == r.length);
+        REQUIRE(std::equal(out.begin(), out.begin() + written,
+                           data.begin() + r.offset));
+    }
+
+    // ranges are cut short at the end
+    REQUIRE(huffman::decodeRange(encodedPath.c_str(), data.size() - 10, 100,
+                                 out.data(), written) == 0);
+    REQUIRE(written == 10);
+    REQUIRE(std::equal(out.begin(), out.begin() + 10, data.end() - 10));
+    REQUIRE(huffman::decodeRange(encodedPath.c_str(), data.size() + 10, 100,
+                                 out.data(), written) == 0);
+    REQUIRE(written == 0);
+
+    // legacy files have no index to seek with
+    REQUIRE(huffman::encodeLegacy(path.c_str(), encodedPath.c_str()) == 0);
+    REQUIRE(huffman::decodeRange(encodedPath.c_str(), 0, 10, out.data(),
+                                 written) == 5);
+    REQUIRE(huffman::decodeRange("doesNotExist.huf", 0, 10, out.data(),
+                                 written) == 1);
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+}
+
+TEST_CASE("checksums catch corruption the code can't", "[file][checksum]")
+{
+    const std::string path = "testChecksum.bin";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    // stored random bytes, where any change still decodes, then text
+    std::mt19937 rng(11);
+    std::vector<unsigned char> data(3 * 4096);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = rng();
+    }
+    std::vector<unsigned char> text = sampleData(4 * 4096 + 99);
+    data.insert(data.end(), text.begin(), text.end());
+    writeFile(path, data);
+
+    for (bool checksum : {false, true})
+    {
+        INFO("checksum: " << checksum);
+        REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str(), 4096,
+                                checksum) == 0);
+        std::vector<unsigned char> encoded = readFile(encodedPath);
+
+        // the first block's bytes start after the frame header, any shared
+        // codes, block header and checksum
+        size_t first = huffman::frameHeaderSize;
+        huffman::BlockHeader header;
+        REQUIRE(huffman::readBlockHeader(&encoded[first],
+                                         encoded.size() - first, header));
+        if (header.type == huffman::blockSharedCodes)
+        {
+            first += huffman::blockHeaderSize + header.payloadSize;
+        }
+        const size_t stored = first + huffman::blockHeaderSize + 100;
+        REQUIRE(((encoded[first] & huffman::checksumFlag) != 0) == checksum);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == 0);
+        REQUIRE(readFile(decodedPath) == data);
+        for (unsigned int threads : {1, 4})
+        {
+            REQUIRE(huffman::verify(encodedPath.c_str(), threads) == 0);
+        }
+
+        // without a checksum, the change goes unnoticed
+        encoded[stored + (checksum ? huffman::blockChecksumSize : 0)] ^= 1;
+        writeFile(encodedPath, encoded);
+        char expected = checksum ? 4 : 0;
+        REQUIRE(huffman::verify(encodedPath.c_str()) == expected);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str())
+                == expected);
+    }
+
+    // legacy files only hold ASCII, and have no blocks to check
+    REQUIRE(huffman::encodeLegacy(path.c_str(), encodedPath.c_str()) == 1);
+    writeFile(path, text);
+    REQUIRE(huffman::encodeLegacy(path.c_str(), encodedPath.c_str()) == 0);
+    REQUIRE(huffman::verify(encodedPath.c_str()) == 5);
+    REQUIRE(huffman::verify("doesNotExist.huf") == 1);
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("stream decoder takes a file in pieces", "[file][stream]")
+{
+    const std::string path = "testStream.txt";
+    const std::string encodedPath = path + ".huf";
+
+    std::vector<unsigned char> data = sampleData(3 * huffman::defaultBlockSize
+                                                 + 99);
+    writeFile(path, data);
+    REQUIRE(huffman::encode(path.c_str(), encodedPath.c_str()) == 0);
+    std::vector<unsigned char> encoded = readFile(encodedPath);
+
+    std::vector<unsigned char> decoded;
+    size_t largestPiece = 0;
+    auto sink = [&](const unsigned char* data, size_t size)
+    {
+        decoded.insert(decoded.end(), data, data + size);
+        largestPiece = std::max(largestPiece, size);
+        return true;
+    };
+
+    for (size_t piece : {1, 7, 4096, 1 << 20})
+    {
+        INFO("piece: " << piece);
+        decoded.clear();
+        huffman::StreamDecoder decoder(sink);
+        bool pushed = true;
+        for (size_t i = 0; i < encoded.size() && pushed; i += piece)
+        {
+            pushed = decoder.push(encoded.data() + i,
+                                  std::min(piece, encoded.size() - i));
+        }
+        REQUIRE(pushed);
+        REQUIRE(decoder.finish());
+        REQUIRE(decoded == data);
+        REQUIRE(largestPiece <= huffman::defaultBlockSize);
+    }
+
+    SECTION("a cut-off file")
+    {
+        huffman::StreamDecoder decoder(sink);
+        REQUIRE(decoder.push(encoded.data(), encoded.size() - 1));
+        REQUIRE(!decoder.finish());
+    }
+
+    SECTION("bytes past the end")
+    {
+        encoded.push_back(0);
+        huffman::StreamDecoder decoder(sink);
+        REQUIRE(!decoder.push(encoded.data(), encoded.size()));
+        REQUIRE(decoder.isFailed());
+    }
+
+    SECTION("istream to ostream")
+    {
+        std::ifstream input(encodedPath, std::ios::binary);
+        std::ostringstream output;
+        REQUIRE(huffman::decode(input, output) == 0);
+        std::string out = output.str();
+        REQUIRE(std::vector<unsigned char>(out.begin(), out.end()) == data);
+
+        std::istringstream garbage("not a huffman file");
+        REQUIRE(huffman::decode(garbage, output) == 4);
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+}
+
+TEST_CASE("legacy files decode on several threads", "[file][parallel]")
+{
+    const std::string path = "testLegacy.txt";
+    const std::string encodedPath = path + ".huf";
+    const std::string decodedPath = path + ".out";
+
+    // text with a sprinkling of rare symbols, whose long codewords make the
+    // speculative walks take longer to fall into step
+    std::vector<unsigned char> data = sampleData(3 << 20);
+    for (size_t i = 0; i < data.size(); i += 1000 + rand() % 5000)
+    {
+        data[i] = '!' + rand() % 10;
+    }
+    writeFile(path, data);
+    REQUIRE(huffman::encodeLegacy(path.c_str(), encodedPath.c_str()) == 0);
+
+    for (unsigned int threads : {1, 2, 3, 7})
+    {
+        INFO("threads: " << threads);
+        remove(decodedPath.c_str());
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                threads) == 0);
+        REQUIRE(readFile(decodedPath) == data);
+    }
+
+    // a header claiming more unused bits than follow it
+    std::vector<unsigned char> corrupt(129, 0);
+    corrupt[0] = 0xE0;
+    writeFile(encodedPath, corrupt);
+    for (unsigned int threads : {1, 4})
+    {
+        INFO("threads: " << threads);
+        REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str(),
+                                threads) == 4);
+    }
+
+    remove(path.c_str());
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
+
+TEST_CASE("decoding a hand-made file", "[file]")
+{
+    // 'a' has codeword 0 and 'b' has 1: 3 bits of unused-bit count (1),
+    // 128 lengths with 1 at 'a' and 'b', then "abba" followed by 1 unused
+    // bit
+    std::vector<unsigned char> encoded(129, 0);
+    encoded[0] = 1 << 5;
+    for (int c : {'a', 'b'})
+    {
+        // the length byte of symbol c starts at bit 3 + 8c
+        size_t bit = 3 + 8 * c + 7;
+        encoded[bit / 8] |= 0x80 >> (bit % 8);
+    }
+    // "abba" = 0110 at bits 1027-1030
+    encoded[128] |= 0x08 | 0x04;
+
+    const std::string encodedPath = "testHandMade.huf";
+    const std::string decodedPath = "testHandMade";
+    writeFile(encodedPath, encoded);
+    REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str()) == 0);
+    std::vector<unsigned char> expected {'a', 'b', 'b', 'a'};
+    REQUIRE(readFile(decodedPath) == expected);
+
+    // cut off in the header
+    encoded.resize(100);
+    writeFile(encodedPath, encoded);
+    REQUIRE(huffman::decode(encodedPath.c_str(), decodedPath.c_str()) == 4);
+
+    remove(encodedPath.c_str());
+    remove(decodedPath.c_str());
+}
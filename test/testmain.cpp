@@ -1,2 +1,3 @@
 #define CATCH_CONFIG_MAIN // Provides a main()
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // MINSIGSTKSZ isn't constant on newer glibc
 #include "catch.hpp"